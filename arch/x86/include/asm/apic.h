@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _ASM_X86_64_APIC_H
+#define _ASM_X86_64_APIC_H
+
+#include <asm/msr.h>
+#include <seren/types.h>
+
+#define APIC_SVR_ENABLE	       (1 << 8)
+#define APIC_LVT_MASKED	       (1 << 16)
+#define APIC_LVT_TIMER_PERIODIC (1 << 17)
+
+/* Divide configuration value for a divisor of 16. */
+#define APIC_TIMER_DIV_16 0x3
+
+/* Local timer interrupts per second, matching the PIT on the BSP. */
+#define APIC_TIMER_HZ 100
+
+/**
+ * apic_eoi - Signal end of interrupt to the local APIC
+ */
+static inline void apic_eoi(void) { wrmsr(MSR_X2APIC_EOI, 0); }
+
+/**
+ * apic_read_id - x2APIC ID of the calling CPU
+ */
+static inline u32 apic_read_id(void) { return (u32)rdmsr(MSR_X2APIC_ID); }
+
+/**
+ * apic_timer_calibrate - Measure the local APIC timer against the PIT
+ *
+ * Runs once on the BSP before the other CPUs are started. All local timers
+ * share the same bus clock, so the result holds for every CPU.
+ *
+ * Returns 0 on success, -1 if the timer never ticked.
+ */
+int apic_timer_calibrate(void);
+
+/**
+ * apic_init_cpu - Enable the local APIC and start its periodic timer
+ *
+ * Called on each application processor. The BSP keeps taking its tick
+ * from the PIT through the legacy PIC.
+ */
+void apic_init_cpu(void);
+
+#endif // _ASM_X86_64_APIC_H
@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _ASM_X86_64_CACHE_H
+#define _ASM_X86_64_CACHE_H
+
+#define L1_CACHE_SHIFT 6
+#define L1_CACHE_BYTES (1 << L1_CACHE_SHIFT)
+
+/* Start on a cache line of its own, so CPUs writing neighbours don't
+ * bounce the line between them. */
+#define ____cacheline_aligned __attribute__((__aligned__(L1_CACHE_BYTES)))
+
+#endif // _ASM_X86_64_CACHE_H
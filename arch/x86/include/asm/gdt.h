@@ -106,4 +106,10 @@ struct tss {
  */
 void gdt_init(void);
 
+/**
+ * gdt_init_cpu - Initialize and load the GDT and TSS of the calling CPU.
+ * @cpu: Logical CPU number of the caller
+ */
+void gdt_init_cpu(unsigned int cpu);
+
 #endif /* _ASM_X86_64_GDT_H */
\ No newline at end of file
@@ -27,6 +27,12 @@
 #define PIC1_START_VECTOR 32
 #define PIC2_START_VECTOR 40
 
+/* Raised by schedule_yield() to switch tasks outside the timer tick. */
+#define SCHED_YIELD_VECTOR 0x81
+
+#define LOCAL_TIMER_VECTOR   0xec
+#define SPURIOUS_APIC_VECTOR 0xff
+
 #define NR_IRQS	   16
 #define NR_VECTORS 256
 
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _ASM_X86_64_MSR_H
+#define _ASM_X86_64_MSR_H
+
+#include <seren/types.h>
+
+#define MSR_IA32_APIC_BASE 0x0000001b
+#define MSR_GS_BASE	   0xc0000101
+
+/* x2APIC registers are MSRs, 0x800 plus the xAPIC MMIO offset / 16. */
+#define MSR_X2APIC_ID	    0x00000802
+#define MSR_X2APIC_EOI	    0x0000080b
+#define MSR_X2APIC_SVR	    0x0000080f
+#define MSR_X2APIC_LVT_TMR  0x00000832
+#define MSR_X2APIC_TMR_INIT 0x00000838
+#define MSR_X2APIC_TMR_CUR  0x00000839
+#define MSR_X2APIC_TMR_DIV  0x0000083e
+
+/**
+ * rdmsr - Read a model specific register.
+ * @msr: The register
+ */
+static inline u64 rdmsr(u32 msr) {
+	u32 lo, hi;
+
+	__asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+	return ((u64)hi << 32) | lo;
+}
+
+/**
+ * wrmsr - Write a model specific register.
+ * @msr: The register
+ * @val: The value to write
+ */
+static inline void wrmsr(u32 msr, u64 val) {
+	__asm__ volatile("wrmsr"
+			 :
+			 : "c"(msr), "a"((u32)val), "d"((u32)(val >> 32))
+			 : "memory");
+}
+
+#endif // _ASM_X86_64_MSR_H
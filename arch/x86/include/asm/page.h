@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _ASM_X86_64_PAGE_H
+#define _ASM_X86_64_PAGE_H
+
+#include <seren/mm/pmm.h>
+#include <seren/types.h>
+
+/**
+ * clear_page - Zero a page with `rep stosq`.
+ * @addr: Kernel virtual address of the page, page aligned
+ *
+ * Goes through the cache, which is what you want when the page is about to
+ * be used.
+ */
+static inline void clear_page(void *addr) {
+	unsigned long count = PAGE_SIZE / 8;
+
+	__asm__ volatile("rep stosq"
+			 : "+D"(addr), "+c"(count)
+			 : "a"(0UL)
+			 : "memory");
+}
+
+/**
+ * copy_page - Copy a page with `rep movsq`.
+ * @to: Kernel virtual address of the destination page
+ * @from: Kernel virtual address of the source page
+ */
+static inline void copy_page(void *to, void *from) {
+	unsigned long count = PAGE_SIZE / 8;
+
+	__asm__ volatile("rep movsq"
+			 : "+D"(to), "+S"(from), "+c"(count)
+			 :
+			 : "memory");
+}
+
+/**
+ * clear_page_nocache - Zero a page with non-temporal stores.
+ * @addr: Kernel virtual address of the page, page aligned
+ *
+ * `movnti` writes around the cache, so zeroing pages ahead of time doesn't
+ * evict anything useful. The stores are weakly ordered, hence the `sfence`
+ * before the page is handed to anyone.
+ */
+static inline void clear_page_nocache(void *addr) {
+	u64 *p = addr;
+
+	for (unsigned long i = 0; i < PAGE_SIZE / 8; i += 4) {
+		__asm__ volatile("movnti %1, 0(%0)\n\t"
+				 "movnti %1, 8(%0)\n\t"
+				 "movnti %1, 16(%0)\n\t"
+				 "movnti %1, 24(%0)"
+				 :
+				 : "r"(p + i), "r"(0UL)
+				 : "memory");
+	}
+	__asm__ volatile("sfence" ::: "memory");
+}
+
+#endif // _ASM_X86_64_PAGE_H
@@ -3,9 +3,37 @@
 #ifndef _ASM_X86_64_PROCESSOR_H
 #define _ASM_X86_64_PROCESSOR_H
 
+#include <seren/types.h>
+
 /**
  * cpu_relax - Hint to the CPU that we are in a spin-wait loop.
  */
 static inline void cpu_relax(void) { __asm__ volatile("pause" ::: "memory"); }
 
+/**
+ * rdtsc - Read the time stamp counter.
+ *
+ * Usable long before any timer is set up, which makes it handy for timing
+ * early boot code.
+ */
+static inline u64 rdtsc(void) {
+	u32 lo, hi;
+
+	__asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((u64)hi << 32) | lo;
+}
+
+/**
+ * cpuid - Query the CPU for a feature leaf.
+ * @leaf: Goes in EAX
+ * @subleaf: Goes in ECX
+ * @eax, @ebx, @ecx, @edx: Filled with the result
+ */
+static inline void cpuid(u32 leaf, u32 subleaf, u32 *eax, u32 *ebx, u32 *ecx,
+			 u32 *edx) {
+	__asm__ volatile("cpuid"
+			 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+			 : "a"(leaf), "c"(subleaf));
+}
+
 #endif // _ASM_X86_64_PROCESSOR_H
\ No newline at end of file
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _ASM_X86_64_SMP_H
+#define _ASM_X86_64_SMP_H
+
+#include <seren/config.h>
+#include <seren/stddef.h>
+#include <seren/types.h>
+
+/**
+ * struct cpu_info - Per-CPU data reachable through %gs
+ * @self: Points back at this structure
+ * @cpu: Logical CPU number, 0 is the bootstrap processor
+ * @lapic_id: Local APIC ID the firmware gave this CPU
+ * @online: Set once the CPU is ready to run tasks
+ *
+ * Every CPU points its GS base at its own entry, so reading a field is a
+ * single %gs-relative load with no table lookup.
+ */
+struct cpu_info {
+	struct cpu_info *self;
+	unsigned int cpu;
+	u32 lapic_id;
+	volatile int online;
+};
+
+extern struct cpu_info cpu_data[NR_CPUS];
+
+/**
+ * arch_smp_processor_id - Read the logical number of this CPU
+ */
+static inline unsigned int arch_smp_processor_id(void) {
+	unsigned int cpu;
+
+	__asm__ volatile("movl %%gs:%c1, %0"
+			 : "=r"(cpu)
+			 : "i"(offsetof(struct cpu_info, cpu)));
+	return cpu;
+}
+
+/**
+ * cpu_set_gs_base - Point GS base of the calling CPU at its cpu_info
+ * @cpu: Logical CPU number
+ *
+ * Loading a selector into %gs clears the base, so this has to be redone
+ * after every GDT reload.
+ */
+void cpu_set_gs_base(unsigned int cpu);
+
+#endif // _ASM_X86_64_SMP_H
@@ -56,6 +56,19 @@ static inline void arch_spin_lock(spinlock_t *lock) {
 	}
 }
 
+/**
+ * arch_spin_trylock - Acquire a spinlock only if it is free.
+ * @lock: The spinlock to acquire.
+ *
+ * Returns 1 if the lock was taken, 0 if someone else holds it.
+ */
+static inline int arch_spin_trylock(spinlock_t *lock) {
+	int expected = 0;
+
+	return __atomic_compare_exchange_n(&lock->locked, &expected, 1, 0,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
 /**
  * arch_spin_unlock - Release a spinlock.
  * @lock: The spinlock to release.
@@ -46,6 +46,14 @@ typedef struct idt_ptr {
  */
 void idt_init(void);
 
+/**
+ * idt_load_cpu - Load the shared IDT on the calling CPU.
+ *
+ * The table is built once by idt_init(); application processors only need
+ * to point their IDTR at it.
+ */
+void idt_load_cpu(void);
+
 /**
  * idt_set_gate - Configure a singe IDT entry.
  * @vector_num: The interrupt vector number (0-255).
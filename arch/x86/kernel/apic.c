@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#define pr_fmt(fmt) "apic: " fmt
+
+#include <asm/apic.h>
+#include <asm/irq_vectors.h>
+#include <asm/processor.h>
+#include <seren/pit.h>
+#include <seren/printk.h>
+
+/* Give up on calibration if the PIT has not expired after this many polls. */
+#define APIC_CALIBRATE_MAX_SPINS (1UL << 28)
+
+/** Initial count that makes the local timer fire APIC_TIMER_HZ times/s. */
+static u32 apic_timer_ticks;
+
+int apic_timer_calibrate(void) {
+	unsigned long spins = 0;
+	u32 elapsed;
+
+	/**
+	 * A masked LVT entry still lets the counter run, it just doesn't
+	 * raise the interrupt. Count down from the top for one PIT tick and
+	 * see how far we got.
+	 */
+	wrmsr(MSR_X2APIC_TMR_DIV, APIC_TIMER_DIV_16);
+	wrmsr(MSR_X2APIC_LVT_TMR, APIC_LVT_MASKED | LOCAL_TIMER_VECTOR);
+
+	pit_oneshot_start(TIMER_FREQUENCY / APIC_TIMER_HZ);
+	wrmsr(MSR_X2APIC_TMR_INIT, 0xFFFFFFFF);
+
+	while (!pit_oneshot_expired()) {
+		if (++spins > APIC_CALIBRATE_MAX_SPINS)
+			break;
+		cpu_relax();
+	}
+
+	elapsed = 0xFFFFFFFF - (u32)rdmsr(MSR_X2APIC_TMR_CUR);
+	wrmsr(MSR_X2APIC_TMR_INIT, 0);
+
+	if (spins > APIC_CALIBRATE_MAX_SPINS || !elapsed) {
+		pr_warn("local timer calibration failed\n");
+		return -1;
+	}
+
+	apic_timer_ticks = elapsed;
+	pr_info("local timer: %u ticks per %u Hz period\n", apic_timer_ticks,
+		APIC_TIMER_HZ);
+	return 0;
+}
+
+void apic_init_cpu(void) {
+	wrmsr(MSR_X2APIC_SVR, APIC_SVR_ENABLE | SPURIOUS_APIC_VECTOR);
+
+	wrmsr(MSR_X2APIC_TMR_DIV, APIC_TIMER_DIV_16);
+	wrmsr(MSR_X2APIC_LVT_TMR, APIC_LVT_TIMER_PERIODIC | LOCAL_TIMER_VECTOR);
+	wrmsr(MSR_X2APIC_TMR_INIT, apic_timer_ticks);
+}
@@ -6,6 +6,7 @@
 #define pr_fmt(fmt) "gdt: " fmt
 
 #include <asm/gdt.h>
+#include <asm/smp.h>
 #include <lib/string.h>
 #include <seren/printk.h>
 
@@ -13,17 +14,22 @@
 extern void gdt_flush(struct gdt_ptr *gdtp);
 extern void tss_flush(u16 selector);
 
-/** The TSS for this CPU. */
-static struct tss tss __attribute__((aligned(16)));
+/**
+ * Every CPU gets its own TSS, and since a TSS descriptor is marked busy once
+ * it is loaded, its own GDT to hold the descriptor as well.
+ */
+static struct tss cpu_tss[NR_CPUS] __attribute__((aligned(16)));
 
-/** A stack for handling double faults, set up via the TSS and IST. */
-static u8 ist_double_fault_stack[IST_STACK_SIZE] __attribute__((aligned(16)));
+/** Stacks for handling double faults, set up via the TSS and IST. */
+static u8 ist_double_fault_stack[NR_CPUS][IST_STACK_SIZE]
+    __attribute__((aligned(16)));
 
-static struct gdt_entry gdt[GDT_ENTRIES];
-static struct gdt_ptr gdtp;
+static struct gdt_entry cpu_gdt[NR_CPUS][GDT_ENTRIES];
+static struct gdt_ptr cpu_gdtp[NR_CPUS];
 
 /*
  * gdt_set_entry - Configure a standard GDT descriptor.
+ * @gdt: The GDT to update.
  * @num: The index in the GDT array.
  * @access: The access byte.
  * @flags: Flags that define granularity and long mode.
@@ -32,7 +38,8 @@ static struct gdt_ptr gdtp;
  * covers the entire address space. In long mode segmentation is mostly
  * disabled but we still need these descriptors to define privilege levels.
  */
-static void gdt_set_entry(int num, u8 access, u8 flags) {
+static void gdt_set_entry(struct gdt_entry *gdt, int num, u8 access,
+			  u8 flags) {
 	gdt[num].limit0 = 0xFFFF;
 	gdt[num].base0 = 0;
 	gdt[num].base1 = 0;
@@ -49,13 +56,14 @@ static void gdt_set_entry(int num, u8 access, u8 flags) {
 
 /*
  * tss_set_entry - Configure the special 16-byte TSS descriptor.
+ * @gdt: The GDT to update.
  * @num: The index in the GDT array where the TSS descriptor starts.
  * @base: The 64-bit linear address of our `tss` structure.
  */
-static void tss_set_entry(int num, u64 base) {
+static void tss_set_entry(struct gdt_entry *gdt, int num, u64 base) {
 	struct tss_entry *desc = (struct tss_entry *)&gdt[num];
 
-	desc->limit0 = sizeof(tss) - 1;
+	desc->limit0 = sizeof(struct tss) - 1;
 	desc->base0 = base & 0xFFFF;
 	desc->base1 = (base >> 16) & 0xFF;
 	desc->base2 = (base >> 24) & 0xFF;
@@ -67,23 +75,27 @@ static void tss_set_entry(int num, u64 base) {
 }
 
 /**
- * gdt_init - Set up the GDT and TSS for 64-bit operation.
+ * gdt_init_cpu - Set up and load the GDT and TSS of one CPU.
+ * @cpu: Logical CPU number of the caller
  */
-void gdt_init(void) {
+void gdt_init_cpu(unsigned int cpu) {
+	struct gdt_entry *gdt = cpu_gdt[cpu];
+	struct tss *tss = &cpu_tss[cpu];
+
 	/**
 	 * First, set up the TSS. We only really care about the IST for now.
 	 * IST[0] corresponds to index 1, so we set that to the top of our
 	 * special double fault stack.
 	 */
-	memset(&tss, 0, sizeof(tss));
-	tss.ist[IST_DOUBLE_FAULT - 1] =
-	    (u64)ist_double_fault_stack + IST_STACK_SIZE;
+	memset(tss, 0, sizeof(*tss));
+	tss->ist[IST_DOUBLE_FAULT - 1] =
+	    (u64)ist_double_fault_stack[cpu] + IST_STACK_SIZE;
 
 	/** Now, populate the GDT entries. The selectors are byte offsets, so we
 	 * divide by 8 to get the array index. */
 
 	/** Kernel Code Segment (Ring 0) */
-	gdt_set_entry(GDT_KERNEL_CODE_SELECTOR / 8,
+	gdt_set_entry(gdt, GDT_KERNEL_CODE_SELECTOR / 8,
 		      GDT_ACCESS_PRESENT | GDT_ACCESS_RING0 |
 			  GDT_ACCESS_TYPE_CODE_DATA |
 			  GDT_ACCESS_TYPE_CODE_READ | GDT_ACCESS_TYPE_CODE_EXEC,
@@ -91,33 +103,43 @@ void gdt_init(void) {
 
 	/** Kernel Data Segment (Ring 0) */
 	gdt_set_entry(
-	    GDT_KERNEL_DATA_SELECTOR / 8,
+	    gdt, GDT_KERNEL_DATA_SELECTOR / 8,
 	    GDT_ACCESS_PRESENT | GDT_ACCESS_RING0 | GDT_ACCESS_TYPE_CODE_DATA |
 		GDT_ACCESS_TYPE_DATA_WRITE,
 	    GDT_FLAG_GRAN_4K | GDT_FLAG_32BIT); /* Data segs use D/B=1 */
 
 	/** User Code Segment (Ring 3) */
-	gdt_set_entry(GDT_USER_CODE_SELECTOR / 8,
+	gdt_set_entry(gdt, GDT_USER_CODE_SELECTOR / 8,
 		      GDT_ACCESS_PRESENT | GDT_ACCESS_RING3 |
 			  GDT_ACCESS_TYPE_CODE_DATA |
 			  GDT_ACCESS_TYPE_CODE_READ | GDT_ACCESS_TYPE_CODE_EXEC,
 		      GDT_FLAG_GRAN_4K | GDT_FLAG_64BIT);
 
 	/** User Data Segment (Ring 3) */
-	gdt_set_entry(GDT_USER_DATA_SELECTOR / 8,
+	gdt_set_entry(gdt, GDT_USER_DATA_SELECTOR / 8,
 		      GDT_ACCESS_PRESENT | GDT_ACCESS_RING3 |
 			  GDT_ACCESS_TYPE_CODE_DATA |
 			  GDT_ACCESS_TYPE_DATA_WRITE,
 		      GDT_FLAG_GRAN_4K | GDT_FLAG_32BIT);
 
 	/** TSS Segment */
-	tss_set_entry(GDT_TSS_SELECTOR / 8, (u64)&tss);
+	tss_set_entry(gdt, GDT_TSS_SELECTOR / 8, (u64)tss);
 
-	gdtp.limit = sizeof(gdt) - 1;
-	gdtp.base = (u64)&gdt;
+	cpu_gdtp[cpu].limit = sizeof(cpu_gdt[cpu]) - 1;
+	cpu_gdtp[cpu].base = (u64)gdt;
 
-	gdt_flush(&gdtp);
+	gdt_flush(&cpu_gdtp[cpu]);
 	tss_flush(GDT_TSS_SELECTOR);
 
+	/* gdt_flush() reloaded %gs, which wiped the per-CPU base. */
+	cpu_set_gs_base(cpu);
+}
+
+/**
+ * gdt_init - Set up the GDT and TSS of the bootstrap processor.
+ */
+void gdt_init(void) {
+	gdt_init_cpu(0);
+
 	pr_info("GDT and TSS initialized and loaded\n");
-}
\ No newline at end of file
+}
@@ -30,6 +30,13 @@ DECLARE_IRQ(5); DECLARE_IRQ(6); DECLARE_IRQ(7); DECLARE_IRQ(8); DECLARE_IRQ(9);
 DECLARE_IRQ(10); DECLARE_IRQ(11); DECLARE_IRQ(12); DECLARE_IRQ(13); DECLARE_IRQ(14);
 DECLARE_IRQ(15);
 
+// Software interrupts
+extern void sched_yield_stub(void);
+
+// Local APIC
+extern void apic_timer_stub(void);
+extern void apic_spurious_stub(void);
+
 // clang-format on
 
 /**
@@ -87,6 +94,13 @@ static const struct idt_init_entry idt_entries[] = {
     {PIC2_START_VECTOR + 5, irq_stub_13, 0},
     {PIC2_START_VECTOR + 6, irq_stub_14, 0},
     {PIC2_START_VECTOR + 7, irq_stub_15, 0},
+
+    /* Software interrupts */
+    {SCHED_YIELD_VECTOR, sched_yield_stub, 0},
+
+    /* Local APIC */
+    {LOCAL_TIMER_VECTOR, apic_timer_stub, 0},
+    {SPURIOUS_APIC_VECTOR, apic_spurious_stub, 0},
 };
 
 static idt_entry_t idt[IDT_MAX_DESCRIPTORS];
@@ -130,4 +144,6 @@ void idt_init(void) {
 
 	idt_load(&idtp);
 	pr_info("IDT loaded and ready.\n");
-}
\ No newline at end of file
+}
+
+void idt_load_cpu(void) { idt_load(&idtp); }
\ No newline at end of file
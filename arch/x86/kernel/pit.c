@@ -45,6 +45,21 @@ void timer_init(void) {
 
 u64 timer_get_uptime_ms(void) { return system_ticks * 10; }
 
+void pit_oneshot_start(u16 count) {
+	/**
+	 * Channel 2 is gated by bit 0 of port 0x61 and shows its output in
+	 * bit 5. Raise the gate, keep the speaker (bit 1) off, then program
+	 * 0xB0: channel 2, lobyte/hibyte, mode 0 (interrupt on terminal
+	 * count). Counting starts once the high byte is written.
+	 */
+	outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+	outb(0x43, 0xB0);
+	outb(0x42, count & 0xFF);
+	outb(0x42, (count >> 8) & 0xFF);
+}
+
+bool pit_oneshot_expired(void) { return inb(0x61) & 0x20; }
+
 static int __init setup_timer(void) {
 	timer_init();
 
@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#define pr_fmt(fmt) "smp: " fmt
+
+#include <asm/apic.h>
+#include <asm/gdt.h>
+#include <asm/irqflags.h>
+#include <asm/msr.h>
+#include <asm/processor.h>
+#include <idt.h>
+#include <limine.h>
+#include <seren/mm/pmm.h>
+#include <seren/printk.h>
+#include <seren/sched/sched.h>
+#include <seren/smp.h>
+
+/* Kernel stack of each AP, the same 16 KiB the BSP boots on. */
+#define AP_STACK_ORDER 2
+
+/* How long to poll for an AP to report in before giving up on it. */
+#define AP_BOOT_TIMEOUT_SPINS (1UL << 27)
+
+extern volatile struct limine_smp_request smp_request;
+
+/* Trampoline in boot/start.S that moves the AP onto its kernel stack. */
+extern void ap_start(struct limine_smp_info *info);
+
+void ap_main(struct limine_smp_info *info);
+
+struct cpu_info cpu_data[NR_CPUS] = {
+    [0] = {.self = &cpu_data[0], .cpu = 0, .online = 1},
+};
+
+void cpu_set_gs_base(unsigned int cpu) {
+	wrmsr(MSR_GS_BASE, (u64)&cpu_data[cpu]);
+}
+
+unsigned int num_online_cpus(void) {
+	unsigned int nr = 0;
+
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++)
+		if (cpu_data[cpu].online)
+			nr++;
+
+	return nr;
+}
+
+/**
+ * ap_main - C entry point of an application processor
+ * @info: What Limine knows about this CPU
+ *
+ * Runs on the stack smp_init() allocated. Loads the per-CPU descriptor
+ * tables, starts the local timer and becomes this CPU's idle task.
+ */
+void ap_main(struct limine_smp_info *info) {
+	unsigned int cpu;
+
+	for (cpu = 1; cpu < NR_CPUS; cpu++) {
+		if (cpu_data[cpu].self &&
+		    cpu_data[cpu].lapic_id == info->lapic_id)
+			break;
+	}
+	if (cpu == NR_CPUS)
+		return;
+
+	cpu_set_gs_base(cpu);
+	gdt_init_cpu(cpu);
+	idt_load_cpu();
+	apic_init_cpu();
+	sched_init_cpu(cpu);
+
+	cpu_data[cpu].online = 1;
+	pr_info("CPU%u (APIC ID %u) online\n", cpu, info->lapic_id);
+
+	local_irq_enable();
+	for (;;)
+		__asm__ volatile("hlt");
+}
+
+/*
+ * Hand one AP its kernel stack and release it. Returns true once the CPU
+ * has marked itself online.
+ */
+static bool __smp_boot_cpu(unsigned int cpu, struct limine_smp_info *info) {
+	struct page *stack = alloc_pages(AP_STACK_ORDER);
+
+	if (!stack) {
+		pr_err("no memory for the stack of CPU%u\n", cpu);
+		return false;
+	}
+
+	cpu_data[cpu].self = &cpu_data[cpu];
+	cpu_data[cpu].cpu = cpu;
+	cpu_data[cpu].lapic_id = info->lapic_id;
+
+	info->extra_argument =
+	    (u64)page_to_virt(stack) + (PAGE_SIZE << AP_STACK_ORDER);
+
+	/**
+	 * The AP spins on goto_address, so it has to be written last and in
+	 * one go. Everything above must be visible before it.
+	 */
+	__atomic_store_n(&info->goto_address, ap_start, __ATOMIC_RELEASE);
+
+	for (unsigned long spins = 0; spins < AP_BOOT_TIMEOUT_SPINS; spins++) {
+		if (cpu_data[cpu].online)
+			return true;
+		cpu_relax();
+	}
+
+	/* The AP may still turn up later, so its stack is not given back. */
+	pr_warn("CPU%u (APIC ID %u) did not come up\n", cpu, info->lapic_id);
+	return false;
+}
+
+void smp_init(void) {
+	struct limine_smp_response *resp = smp_request.response;
+	unsigned int cpu = 1;
+
+	if (!resp || resp->cpu_count < 2) {
+		pr_info("running on the bootstrap processor only\n");
+		return;
+	}
+
+	cpu_data[0].lapic_id = resp->bsp_lapic_id;
+
+	if (!(resp->flags & LIMINE_SMP_X2APIC)) {
+		pr_warn("x2APIC not available, not starting other CPUs\n");
+		return;
+	}
+
+	if (apic_timer_calibrate())
+		return;
+
+	for (u64 i = 0; i < resp->cpu_count; i++) {
+		struct limine_smp_info *info = resp->cpus[i];
+
+		if (info->lapic_id == resp->bsp_lapic_id)
+			continue;
+		if (cpu >= NR_CPUS) {
+			pr_warn("only %u of %lu CPUs are supported\n", NR_CPUS,
+				resp->cpu_count);
+			break;
+		}
+
+		/* A slot whose CPU timed out is never reused. */
+		__smp_boot_cpu(cpu, info);
+		cpu++;
+	}
+
+	pr_info("%u of %lu CPUs online\n", num_online_cpus(),
+		resp->cpu_count);
+}
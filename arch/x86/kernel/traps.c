@@ -5,12 +5,14 @@
 
 #define pr_fmt(fmt) "traps: " fmt
 
+#include <asm/apic.h>
 #include <asm/irq_vectors.h>
 #include <pic.h>
 #include <seren/interrupt.h>
 #include <seren/panic.h>
 #include <seren/pit.h>
 #include <seren/printk.h>
+#include <seren/sched/sched.h>
 #include <seren/spinlock.h>
 #include <seren/stddef.h>
 
@@ -100,6 +102,17 @@ int handle_interrupt(struct pt_regs *regs) {
 	if (regs->vector < FIRST_EXTERNAL_VECTOR) {
 		do_exception(regs);
 		return 0; /* Should be unreachable */
+	} else if (regs->vector == SCHED_YIELD_VECTOR) {
+		/* schedule_yield(); nothing to acknowledge. */
+		sched_yield_interrupt();
+		return 1;
+	} else if (regs->vector == LOCAL_TIMER_VECTOR) {
+		/* The local APIC timer ticks the scheduler on the APs. */
+		apic_eoi();
+		return 1;
+	} else if (regs->vector == SPURIOUS_APIC_VECTOR) {
+		/* Spurious APIC interrupts must not be acknowledged. */
+		return 0;
 	} else {
 		return do_irq(regs);
 	}
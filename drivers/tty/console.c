@@ -11,6 +11,7 @@
 #include <seren/spinlock.h>
 #include <seren/tty.h>
 #include <seren/vc.h>
+#include <seren/wait.h>
 
 #define COLOR_BLACK	    0x00000000
 #define COLOR_RED	    0x00FF0000
@@ -34,10 +35,18 @@ static u32 fg_color = CONSOLE_DEFAULT_FG;
 static u32 bg_color = CONSOLE_DEFAULT_BG;
 static bool initialized = false;
 
-#define LINE_BUF_SIZE 256
+#define LINE_BUF_SIZE TTY_LINE_MAX
 static char line_buffer[LINE_BUF_SIZE];
 static unsigned int line_buffer_pos = 0;
 
+/**
+ * The last line submitted with Enter, waiting for tty_read_line(). A line
+ * that nobody has read yet is replaced by the next one.
+ */
+static char read_buffer[LINE_BUF_SIZE];
+static bool line_ready = false;
+static DECLARE_WAIT_QUEUE_HEAD(tty_read_wait);
+
 static u32 level_colors[] = {
     [LOGLEVEL_EMERG] = COLOR_BRIGHT_RED,
     [LOGLEVEL_ALERT] = COLOR_BRIGHT_RED,
@@ -164,6 +173,7 @@ void tty_receive_char(char c) {
 		return;
 
 	u64 flags;
+	bool wake = false;
 	spin_lock_irqsave(&console_lock, flags);
 
 	switch (c) {
@@ -176,9 +186,9 @@ void tty_receive_char(char c) {
 	case '\n': // Enter
 		line_buffer[line_buffer_pos] = '\0';
 		__console_putchar('\n');
-		// For now, we just print the line that was "submitted".
-		// In the future, this would wake up a waiting process.
-		pr_info("TTY received line: '%s'\n", line_buffer);
+		memcpy(read_buffer, line_buffer, line_buffer_pos + 1);
+		line_ready = true;
+		wake = true;
 		line_buffer_pos = 0;
 		break;
 	default: // Regular character
@@ -190,6 +200,37 @@ void tty_receive_char(char c) {
 	}
 
 	spin_unlock_irqrestore(&console_lock, flags);
+
+	if (wake)
+		wake_up(&tty_read_wait);
+}
+
+size_t tty_read_line(char *buf, size_t size) {
+	bool got = false;
+	size_t len = 0;
+	u64 flags;
+
+	if (!buf || !size)
+		return 0;
+
+	/* Another reader may take the line first; then wait for the next. */
+	while (!got) {
+		wait_event(tty_read_wait, line_ready);
+
+		spin_lock_irqsave(&console_lock, flags);
+		if (line_ready) {
+			len = strlen(read_buffer);
+			if (len > size - 1)
+				len = size - 1;
+			memcpy(buf, read_buffer, len);
+			buf[len] = '\0';
+			line_ready = false;
+			got = true;
+		}
+		spin_unlock_irqrestore(&console_lock, flags);
+	}
+
+	return len;
 }
 
 static struct console tty_console = {
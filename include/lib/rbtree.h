@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include <seren/stddef.h>
+#include <seren/types.h>
+
+#define RB_RED	 0
+#define RB_BLACK 1
+
+/**
+ * struct rb_node - A node of a red-black tree
+ *
+ * Embed this in the structure to be kept sorted. The tree code never
+ * looks at keys; callers walk down from the root themselves to find the
+ * insertion point, link the node with rb_link_node() and then rebalance
+ * with rb_insert_color().
+ */
+struct rb_node {
+	struct rb_node *rb_parent;
+	struct rb_node *rb_left;
+	struct rb_node *rb_right;
+	int rb_color;
+};
+
+struct rb_root {
+	struct rb_node *rb_node;
+};
+
+/**
+ * struct rb_root_cached - A red-black tree that remembers its first node
+ *
+ * Keeps rb_first() O(1) for users, like the scheduler, that mostly want
+ * the smallest key.
+ */
+struct rb_root_cached {
+	struct rb_root rb_root;
+	struct rb_node *rb_leftmost;
+};
+
+#define RB_ROOT		((struct rb_root){NULL})
+#define RB_ROOT_CACHED	((struct rb_root_cached){{NULL}, NULL})
+#define RB_EMPTY_ROOT(root) ((root)->rb_node == NULL)
+
+/**
+ * rb_entry - Get the struct for this node
+ * @ptr: The &struct rb_node pointer
+ * @type: The type of the struct this is embedded in
+ * @member: The name of the rb_node within the struct
+ */
+#define rb_entry(ptr, type, member)                                            \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/**
+ * rb_link_node - Hang a new node off its parent
+ * @node: The node to insert
+ * @parent: The node found while searching, or NULL for an empty tree
+ * @rb_link: The child pointer of @parent (or the root) to fill in
+ *
+ * The node starts out red; follow up with rb_insert_color().
+ */
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+				struct rb_node **rb_link) {
+	node->rb_parent = parent;
+	node->rb_left = NULL;
+	node->rb_right = NULL;
+	node->rb_color = RB_RED;
+	*rb_link = node;
+}
+
+/**
+ * rb_insert_color - Rebalance the tree after rb_link_node()
+ * @node: The node just linked in
+ * @root: The tree
+ */
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+
+/**
+ * rb_erase - Remove a node from the tree
+ * @node: The node to remove
+ * @root: The tree
+ */
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+/**
+ * rb_first - The node with the smallest key, or NULL if the tree is empty
+ */
+struct rb_node *rb_first(const struct rb_root *root);
+
+/**
+ * rb_last - The node with the largest key, or NULL if the tree is empty
+ */
+struct rb_node *rb_last(const struct rb_root *root);
+
+/**
+ * rb_next - In-order successor of @node, or NULL at the end
+ */
+struct rb_node *rb_next(const struct rb_node *node);
+
+/**
+ * rb_prev - In-order predecessor of @node, or NULL at the start
+ */
+struct rb_node *rb_prev(const struct rb_node *node);
+
+/**
+ * rb_insert_color_cached - rb_insert_color() for a cached tree
+ * @leftmost: True if @node went in left of every existing node
+ */
+static inline void rb_insert_color_cached(struct rb_node *node,
+					  struct rb_root_cached *root,
+					  bool leftmost) {
+	if (leftmost)
+		root->rb_leftmost = node;
+	rb_insert_color(node, &root->rb_root);
+}
+
+/**
+ * rb_erase_cached - rb_erase() for a cached tree
+ */
+static inline void rb_erase_cached(struct rb_node *node,
+				   struct rb_root_cached *root) {
+	if (root->rb_leftmost == node)
+		root->rb_leftmost = rb_next(node);
+	rb_erase(node, &root->rb_root);
+}
+
+/**
+ * rb_first_cached - The smallest node of a cached tree, in O(1)
+ */
+static inline struct rb_node *
+rb_first_cached(const struct rb_root_cached *root) {
+	return root->rb_leftmost;
+}
+
+#endif // RBTREE_H
@@ -21,4 +21,7 @@
 #define likely(x)   __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+/* Inline even when optimizing for size, for code that must constant-fold. */
+#define __always_inline inline __attribute__((__always_inline__))
+
 #endif // _SEREN_COMPILER_H
\ No newline at end of file
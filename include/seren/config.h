@@ -6,4 +6,6 @@
 #define KERNEL_VIRTUAL_BASE	  0xffffffff80000000ULL
 #define KERNEL_PHYSICAL_LOAD_ADDR 0x0000000000100000ULL
 
+#define NR_CPUS 16
+
 #endif // KERNEL_CONFIG_H
\ No newline at end of file
@@ -28,6 +28,10 @@ typedef int (*initcall_t)(void);
 extern initcall_t __initcall_start;
 extern initcall_t __initcall_end;
 
+/* Bounds of the .init sections, given back to the allocator after boot. */
+extern char __init_begin[];
+extern char __init_end[];
+
 /* Level 0: Pure initialization, very early. No dependencies. */
 #define pure_initcall(fn) __define_initcall(fn, 0)
 /* Level 1: Core subsystems, like the PMM. */
@@ -225,6 +225,14 @@ static inline int list_is_singular(const struct list_head *head) {
 #define list_for_each(pos, head)                                               \
 	for (pos = (head)->next; pos != (head); pos = pos->next)
 
+/**
+ * list_for_each_prev - Iterate over a list backwards
+ * @pos: The &struct list_head to use as a loop cursor
+ * @head: The head for your list
+ */
+#define list_for_each_prev(pos, head)                                          \
+	for (pos = (head)->prev; pos != (head); pos = pos->prev)
+
 /**
  * list_for_each_safe - Iterate over a list safe against removal of list entry
  * @pos: The &struct list_head to use as a loop cursor
@@ -2,15 +2,30 @@
 #ifndef _SEREN_MM_H
 #define _SEREN_MM_H
 
+#include <seren/compiler.h>
+#include <seren/mm/slab.h>
 #include <seren/types.h>
 
+/**
+ * __kmalloc - Out-of-line kmalloc(), for sizes not known at compile time.
+ * @size: The number of bytes to allocate.
+ */
+void *__kmalloc(size_t size);
+
 /**
  * kmalloc - Allocate a block of memory from the kernel heap.
  * @size: The number of bytes to allocate.
  *
- * Allocates at least @size bytes of physically contiguous memory.
+ * Allocates at least @size bytes of physically contiguous memory. When
+ * @size is a compile-time constant that fits a kmalloc class, the class
+ * is picked here and the size lookup disappears from the call site.
  */
-void *kmalloc(size_t size);
+static __always_inline void *kmalloc(size_t size) {
+	if (__builtin_constant_p(size) && size &&
+	    size <= KMALLOC_MAX_CACHE_SIZE)
+		return kmalloc_class_alloc(kmalloc_index(size), size);
+	return __kmalloc(size);
+}
 
 /**
  * kfree - Free a block of memory.
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SEREN_MM_GFP_H
+#define _SEREN_MM_GFP_H
+
+#include <seren/types.h>
+
+/**
+ * gfp_t - "Get free pages" flags passed to the page allocator
+ *
+ * The zone modifiers limit where the pages may come from. Without one the
+ * allocator starts at the highest zone and only falls back to low memory
+ * when everything above it is used up.
+ */
+typedef unsigned int gfp_t;
+
+#define GFP_DMA	  (1U << 0) /* Frames below 16 MiB, for legacy ISA DMA */
+#define GFP_DMA32 (1U << 1) /* Frames below 4 GiB, for 32-bit DMA masks */
+
+/* Never call the shrinkers, not even below the low watermark. */
+#define __GFP_NORECLAIM (1U << 2)
+
+#define GFP_KERNEL 0U
+
+/**
+ * enum zone_type - The physical memory zones, from lowest to highest
+ */
+enum zone_type {
+	ZONE_DMA,
+	ZONE_DMA32,
+	ZONE_NORMAL,
+	MAX_NR_ZONES,
+};
+
+/**
+ * gfp_zone - The highest zone an allocation with @gfp may be served from.
+ */
+static inline enum zone_type gfp_zone(gfp_t gfp) {
+	if (gfp & GFP_DMA)
+		return ZONE_DMA;
+	if (gfp & GFP_DMA32)
+		return ZONE_DMA32;
+	return ZONE_NORMAL;
+}
+
+#endif // _SEREN_MM_GFP_H
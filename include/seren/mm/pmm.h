@@ -4,6 +4,8 @@
 #define _SEREN_MM_PMM_H
 
 #include <limine.h>
+#include <seren/list.h>
+#include <seren/mm/gfp.h>
 #include <seren/stddef.h>
 
 #define PAGE_SHIFT 12
@@ -11,16 +13,84 @@
 #define PAGE_MASK  (~(PAGE_SIZE - 1))
 
 #define PFN_ALIGN(x) (((unsigned long)(x) + PAGE_SIZE - 1) & PAGE_MASK)
-#define PFN_UP(x)    (((unsigned_long)(x) + PAGE_SIZE - 1) >> PAGE_SHIFT)
+#define PFN_UP(x)    (((unsigned long)(x) + PAGE_SIZE - 1) >> PAGE_SHIFT)
 #define PFN_DOWN(x)  ((unsigned long)(x) >> PAGE_SHIFT)
 #define PFN_PHYS(x)  ((phys_addr_t)(x) << PAGE_SHIFT)
 
+/**
+ * The buddy allocator hands out blocks of 2^order pages, where order ranges
+ * from 0 up to MAX_ORDER - 1. The largest block is therefore 4 MiB.
+ */
+#define MAX_ORDER 11
+
+/* Page flags */
+#define PG_buddy (1U << 0) /* Page heads a free block on a buddy free list */
+#define PG_pcp	 (1U << 1) /* Page is cached on a per-CPU page list */
+#define PG_movable (1U << 2) /* Page can be moved by compaction */
+#define PG_slab	   (1U << 3) /* Page is part of a slab */
+#define PG_large   (1U << 4) /* Page heads a large kmalloc() block */
+
+struct page;
+struct kmem_cache;
+
+/**
+ * struct movable_operations - How the owner of a movable page moves it
+ * @migrate_page: Called once the contents of @src have been copied to @dst.
+ *                The owner switches its references over to @dst, calls
+ *                clear_page_movable() on @src and set_page_movable() on
+ *                @dst, and returns 0. Returns non-zero if the page can't be
+ *                moved right now, in which case nothing changes.
+ */
+struct movable_operations {
+	int (*migrate_page)(struct page *dst, struct page *src);
+};
+
+/**
+ * Default watermarks for the per-CPU page lists. An empty list is refilled
+ * up to PCP_DEFAULT_LOW pages, and a list that grows past PCP_DEFAULT_HIGH
+ * is drained back down to PCP_DEFAULT_LOW.
+ */
+#define PCP_DEFAULT_LOW	 16
+#define PCP_DEFAULT_HIGH 64
+
+/**
+ * Default free memory watermarks. Once free memory drops below the low
+ * watermark the allocator asks the shrinkers to bring it back up to the
+ * high one. The low watermark is 1/PMM_WMARK_LOW_RATIO of RAM, but at
+ * least PMM_WMARK_LOW_MIN pages, and the high one is twice that.
+ */
+#define PMM_WMARK_LOW_RATIO 256
+#define PMM_WMARK_LOW_MIN   64
+
 /**
  * struct page - Abstract handle for a physical page frame
  * @pfn: Page frame number
+ * @flags: PG_* state bits
+ * @order: Order of the free block this page heads (with PG_buddy), of the
+ *         slab the page is part of (with PG_slab), or of the kmalloc()
+ *         block it heads (with PG_large)
+ * @list: Links the page into a buddy free list or a per-CPU page list, or
+ *        whatever list its owner keeps it on (for slabs, the cache's lists)
+ * @mops: How to move the page (only valid with PG_movable)
+ * @slab_cache: The cache the slab belongs to (first page of a slab only)
+ * @freelist: The slab's first free object, linked through the objects
+ * @inuse: Objects currently allocated from the slab
+ * @objects: Objects the slab holds in total
  */
 struct page {
 	u64 pfn;
+	u32 flags;
+	u32 order;
+	struct list_head list;
+	union {
+		const struct movable_operations *mops;
+		struct {
+			struct kmem_cache *slab_cache;
+			void *freelist;
+			u16 inuse;
+			u16 objects;
+		};
+	};
 };
 
 /**
@@ -29,11 +99,32 @@ struct page {
  */
 void mem_init(volatile struct limine_memmap_request *memmap_request);
 
+/**
+ * get_order - The smallest order whose block holds @size bytes
+ * @size: Bytes needed, at least 1
+ */
+static inline u32 get_order(size_t size) {
+	if (size <= PAGE_SIZE)
+		return 0;
+	return 64 - __builtin_clzl((size - 1) >> PAGE_SHIFT);
+}
+
+/**
+ * alloc_pages_flags - Allocate a contiguous block of physical pages
+ * @order:  The order of the allocation (2^order pages)
+ * @gfp:    GFP_* flags, e.g. GFP_DMA32 for a device with a 32-bit DMA mask
+ */
+struct page *alloc_pages_flags(u32 order, gfp_t gfp);
+
 /**
  * alloc_pages - Allocate a contiguous block of physical pages
  * @order:  The order of the allocation (2^order pages)
+ *
+ * Inline wrapper around alloc_pages_flags(order, GFP_KERNEL);
  */
-struct page *alloc_pages(u32 order);
+static inline struct page *alloc_pages(u32 order) {
+	return alloc_pages_flags(order, GFP_KERNEL);
+}
 
 /**
  * free_pages - Free a contiguous block of physical pages
@@ -42,6 +133,23 @@ struct page *alloc_pages(u32 order);
  */
 void free_pages(struct page *page, u32 order);
 
+/**
+ * alloc_contig_pages - Allocate an arbitrary run of physical pages
+ * @nr_pages: Number of pages, need not be a power of two
+ * @align_order: The first page's PFN is a multiple of 2^align_order
+ *
+ * Meant for blocks larger than the buddy allocator can hand out. This
+ * searches the page bitmap, so it is much slower than alloc_pages().
+ */
+struct page *alloc_contig_pages(unsigned long nr_pages, u32 align_order);
+
+/**
+ * free_contig_pages - Free a run allocated with alloc_contig_pages()
+ * @page: The first page of the run
+ * @nr_pages: The number of pages that were allocated
+ */
+void free_contig_pages(struct page *page, unsigned long nr_pages);
+
 /**
  * alloc_page - Allocate a single physical page
  *
@@ -55,6 +163,157 @@ static inline struct page *alloc_page(void) { return alloc_pages(0); }
  */
 static inline void free_page(struct page *page) { free_pages(page, 0); }
 
+/**
+ * Huge pages are naturally aligned blocks that a single page table entry one
+ * or two levels up can map: 2 MiB at the PMD level and 1 GiB at the PUD
+ * level. 2 MiB blocks come straight from the buddy allocator, 1 GiB ones are
+ * bigger than MAX_ORDER and go through alloc_contig_pages().
+ */
+#define HPAGE_PMD_ORDER 9
+#define HPAGE_PUD_ORDER 18
+
+enum hpage_size {
+	HPAGE_PMD,
+	HPAGE_PUD,
+	NR_HPAGE_SIZES,
+};
+
+/**
+ * struct hpage_stats - Huge page counters for one size
+ * @available: Aligned free blocks of this size right now
+ * @allocs: Successful alloc_huge_page() calls
+ * @failures: alloc_huge_page() calls that found no aligned block
+ */
+struct hpage_stats {
+	unsigned long available;
+	unsigned long allocs;
+	unsigned long failures;
+};
+
+/**
+ * alloc_huge_page - Allocate a naturally aligned huge page
+ * @size: HPAGE_PMD for 2 MiB or HPAGE_PUD for 1 GiB
+ */
+struct page *alloc_huge_page(enum hpage_size size);
+
+/**
+ * free_huge_page - Free a block allocated with alloc_huge_page()
+ * @page: The first page of the block
+ * @size: The size it was allocated with
+ */
+void free_huge_page(struct page *page, enum hpage_size size);
+
+/**
+ * hpage_get_stats - Read the huge page counters
+ * @size: The huge page size to report on
+ * @stats: Filled out with a snapshot of the counters
+ *
+ * @stats->available comes from a walk over the free ranges in the bitmap, so
+ * it shows how far memory has fragmented. Returns 0 on success or -1 if
+ * @size is out of range.
+ */
+int hpage_get_stats(enum hpage_size size, struct hpage_stats *stats);
+
+/**
+ * struct pcp_stats - Counters for one CPU's order-0 page cache
+ * @count: Pages currently cached
+ * @hits: Single-page allocations served straight from the cache
+ * @misses: Single-page allocations that found the cache empty
+ * @refills: Batches pulled from the buddy allocator
+ * @drains: Batches given back to the buddy allocator
+ */
+struct pcp_stats {
+	unsigned long count;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long refills;
+	unsigned long drains;
+};
+
+/**
+ * set_page_movable - Let compaction move an order-0 page
+ * @page: A page allocated by the caller
+ * @mops: Called when the page is moved, see struct movable_operations
+ *
+ * The caller must serialize this against its own @mops->migrate_page().
+ */
+void set_page_movable(struct page *page,
+		      const struct movable_operations *mops);
+
+/**
+ * clear_page_movable - Pin a page that was movable before
+ * @page: The page
+ *
+ * Does nothing if @page isn't movable.
+ */
+void clear_page_movable(struct page *page);
+
+/**
+ * struct compact_stats - Memory compaction counters
+ * @runs: Times a failed high-order allocation started compaction
+ * @successes: Runs after which the allocation went through
+ * @pages_moved: Movable pages migrated in total
+ * @cycles: TSC cycles spent compacting in total
+ */
+struct compact_stats {
+	unsigned long runs;
+	unsigned long successes;
+	unsigned long pages_moved;
+	u64 cycles;
+};
+
+/**
+ * compact_get_stats - Read the compaction counters
+ * @stats: Filled out with a snapshot of the counters
+ */
+void compact_get_stats(struct compact_stats *stats);
+
+/**
+ * free_reserved_area - Hand reserved memory over to the page allocator
+ * @start: Physical start address, rounded up to a page
+ * @end: Physical end address, rounded down to a page
+ * @name: What the memory was used for, for the log message
+ *
+ * Meant for memory that was set aside at boot and is no longer needed. Frames
+ * without a `struct page` or that are already free are skipped.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long free_reserved_area(phys_addr_t start, phys_addr_t end,
+				 const char *name);
+
+/**
+ * pcp_set_watermarks - Tune the per-CPU page lists
+ * @low: Pages an empty list is refilled to, and drained down to
+ * @high: Pages a list may hold before it is drained
+ */
+void pcp_set_watermarks(unsigned int low, unsigned int high);
+
+/**
+ * pmm_set_watermarks - Tune when the allocator starts reclaiming
+ * @low: Free pages below which the shrinkers are called
+ * @high: Free pages the shrinkers are asked to get back to
+ */
+void pmm_set_watermarks(unsigned long low, unsigned long high);
+
+/**
+ * pmm_get_watermarks - Read when the allocator starts reclaiming
+ * @low: Set to the free page count below which the shrinkers are called
+ * @high: Set to the free page count the shrinkers are asked to get back to
+ *
+ * Either pointer may be NULL.
+ */
+void pmm_get_watermarks(unsigned long *low, unsigned long *high);
+
+/**
+ * pcp_get_stats - Read the page cache counters of a CPU
+ * @cpu: The CPU to read
+ * @stats: Filled out with a snapshot of the counters
+ *
+ * Returns 0 on success or -1 if @cpu is out of range.
+ */
+int pcp_get_stats(unsigned int cpu, struct pcp_stats *stats);
+
 /**
  * page_to_phys - Convert a `struct page` to its physical address
  * @page: The page structure to convert.
@@ -64,9 +323,20 @@ phys_addr_t page_to_phys(struct page *page);
 /**
  * phys_to_page - Convert a physical address to its `struct page`
  * @phys: The physical memory address.
+ *
+ * Returns NULL if @phys is not backed by a `struct page` (see pfn_valid()).
  */
 struct page *phys_to_page(phys_addr_t phys);
 
+/**
+ * pfn_valid - Check whether a PFN has a `struct page`
+ * @pfn: The page frame number
+ *
+ * Only 128 MiB sections that contain RAM get `struct page`s, so frames in
+ * memory holes don't have one.
+ */
+int pfn_valid(u64 pfn);
+
 /**
  * virt_to_page - Convert a kernel virtual address to its `struct page`
  * @addr: The kernel virtual address (from the HHDM)
@@ -88,6 +358,15 @@ static inline void *page_to_virt(struct page *page) {
 	return (void *)(hhdm_offset + page_to_phys(page));
 }
 
+/**
+ * nr_free_zone_pages - Returns the number of free pages in a zone
+ * @zone: The zone to query
+ *
+ * Pages cached on the per-CPU lists are not included, pages in chunks of the
+ * zone that haven't been initialized yet are.
+ */
+unsigned long nr_free_zone_pages(enum zone_type zone);
+
 /**
  * totalram_pages - Returns the total amount of physical memory managed
  */
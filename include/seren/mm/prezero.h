@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SEREN_MM_PREZERO_H
+#define _SEREN_MM_PREZERO_H
+
+#include <seren/mm/pmm.h>
+#include <seren/types.h>
+
+/* Zeroed pages the idle loop tries to keep around. */
+#define PREZERO_POOL_SIZE 64
+
+/**
+ * struct prezero_stats - Counters for the pre-zeroed page pool
+ * @count: Pages currently in the pool
+ * @hits: alloc_page_zeroed() calls served from the pool
+ * @misses: alloc_page_zeroed() calls that had to zero a page themselves
+ * @filled: Pages zeroed in the background so far
+ */
+struct prezero_stats {
+	unsigned long count;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long filled;
+};
+
+/**
+ * alloc_page_zeroed - Allocate a single page filled with zeroes
+ *
+ * Takes a page from the pre-zeroed pool if there is one, otherwise allocates
+ * a page and clears it on the spot.
+ */
+struct page *alloc_page_zeroed(void);
+
+/**
+ * prezero_refill - Zero some pages for the pool
+ * @budget: The most pages to zero in this call
+ *
+ * Meant to be called from the idle loop. Does nothing once the pool holds
+ * PREZERO_POOL_SIZE pages or free memory is down to the PMM's high
+ * watermark.
+ *
+ * Returns the number of pages added to the pool.
+ */
+unsigned int prezero_refill(unsigned int budget);
+
+/**
+ * prezero_get_stats - Read the pool counters
+ * @stats: Filled out with a snapshot of the counters
+ */
+void prezero_get_stats(struct prezero_stats *stats);
+
+#endif // _SEREN_MM_PREZERO_H
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SEREN_MM_SHRINKER_H
+#define _SEREN_MM_SHRINKER_H
+
+#include <seren/list.h>
+#include <seren/types.h>
+
+/**
+ * struct shrinker - Something that can give pages back when memory is tight
+ * @count_pages: How many pages it could free right now, roughly
+ * @scan_pages: Free up to @nr pages and return how many were freed
+ * @list: Entry in the list of registered shrinkers
+ *
+ * Both callbacks may be invoked from inside the page allocator, with
+ * whatever locks the allocating code holds. They must not sleep or allocate
+ * memory, and should skip anything whose lock they can't take right away.
+ */
+struct shrinker {
+	unsigned long (*count_pages)(struct shrinker *s);
+	unsigned long (*scan_pages)(struct shrinker *s, unsigned long nr);
+	struct list_head list;
+};
+
+/**
+ * struct shrink_stats - Counters for memory-pressure reclaim
+ * @runs: shrink_slab() calls that went through the shrinkers
+ * @requested: Pages those calls asked for
+ * @freed: Pages the shrinkers gave back
+ */
+struct shrink_stats {
+	unsigned long runs;
+	unsigned long requested;
+	unsigned long freed;
+};
+
+/**
+ * register_shrinker - Have a shrinker called under memory pressure.
+ * @s: The shrinker, with both callbacks set
+ */
+void register_shrinker(struct shrinker *s);
+
+/**
+ * unregister_shrinker - Stop calling a shrinker.
+ * @s: A shrinker passed to register_shrinker() before
+ */
+void unregister_shrinker(struct shrinker *s);
+
+/**
+ * shrink_slab - Ask the registered shrinkers for memory.
+ * @nr: How many pages are wanted
+ *
+ * Goes through the shrinkers in registration order until @nr pages have
+ * been freed or every shrinker had its turn. Called by the page allocator
+ * when free memory falls below its low watermark and before it gives up
+ * on an allocation. A call made while another one is running returns 0
+ * right away instead of recursing.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long shrink_slab(unsigned long nr);
+
+/**
+ * shrink_get_stats - Read the reclaim counters.
+ * @stats: Filled out with a snapshot of the counters
+ */
+void shrink_get_stats(struct shrink_stats *stats);
+
+#endif // _SEREN_MM_SHRINKER_H
@@ -3,89 +3,182 @@
 #ifndef _SEREN_MM_SLAB_H
 #define _SEREN_MM_SLAB_H
 
+#include <asm/cache.h>
+#include <seren/compiler.h>
+#include <seren/config.h>
 #include <seren/list.h>
+#include <seren/mm/pmm.h>
+#include <seren/spinlock.h>
 #include <seren/stddef.h>
 #include <seren/types.h>
 
+/**
+ * kmalloc size classes are the powers of two from 2^KMALLOC_MIN_SHIFT to
+ * 2^KMALLOC_MAX_SHIFT, plus 96, 192 and 384 bytes so requests just past a
+ * power of two don't waste half their memory.
+ */
 #define KMALLOC_MIN_SHIFT  3
 #define KMALLOC_MAX_SHIFT  12
-#define KMALLOC_NUM_CACHES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT)
+#define KMALLOC_NUM_CACHES 13
 
-#define KMALLOC_MAX_SIZE (128 * 1024)
+/* Requests in each class's histogram are split into this many buckets. */
+#define KMALLOC_HIST_BUCKETS 4
+
+/* The biggest kmalloc() served by a slab cache. Anything larger goes
+ * straight to the page allocator, up to KMALLOC_MAX_SIZE. */
+#define KMALLOC_MAX_CACHE_SIZE (1UL << KMALLOC_MAX_SHIFT)
+
+/**
+ * A slab is 2^order pages. Each cache picks the smallest order that wastes
+ * no more than 1/SLAB_WASTE_FRACTION of the slab on leftover space at the
+ * end, up to SLAB_MAX_ORDER.
+ */
+#define SLAB_MAX_ORDER	    3
+#define SLAB_WASTE_FRACTION 8
+
+/**
+ * Empty slabs a cache keeps around for the next allocations. The rest go
+ * back to the page allocator as soon as they empty, and these do too once
+ * the page allocator reports memory pressure.
+ */
+#define SLAB_MAX_FREE_SLABS 4
 
-#define SLAB_PAGE_MAGIC 0x51ab51ab
+/**
+ * Each CPU keeps a magazine of up to SLAB_MAG_SIZE free objects per cache.
+ * Caches of objects at least SLAB_MAG_BIG_OBJECT bytes in size keep fewer,
+ * SLAB_MAG_SIZE_BIG, so idle magazines don't pin too much memory.
+ */
+#define SLAB_MAG_SIZE	    32
+#define SLAB_MAG_SIZE_BIG   8
+#define SLAB_MAG_BIG_OBJECT 1024
+
+/* kmem_cache_create() flags */
+#define SLAB_HWCACHE_ALIGN (1UL << 0) /* Align objects to cache lines */
+
+#define KMALLOC_MAX_SIZE (128 * 1024)
 
 /**
  * Forward declarations
  */
 struct kmem_cache;
-struct slab;
+
+/**
+ * struct array_cache - A CPU's magazine of free objects for one cache.
+ * @avail: Objects currently in @entry, the most recently freed one last
+ * @limit: How many objects the magazine may hold
+ * @batchcount: Objects moved per refill or flush
+ * @allocs: Objects this CPU has allocated from the cache
+ * @frees: Objects this CPU has freed to the cache
+ * @entry: The objects
+ *
+ * Only touched by its own CPU with interrupts disabled, so it needs no lock.
+ * Objects in a magazine still count as allocated in their slab. Each one
+ * gets its own cache lines so that CPUs don't share them.
+ */
+struct array_cache {
+	unsigned int avail;
+	unsigned int limit;
+	unsigned int batchcount;
+	unsigned long allocs;
+	unsigned long frees;
+	void *entry[SLAB_MAG_SIZE];
+} ____cacheline_aligned;
 
 /**
  * struct kmem_cache - A cache for objects of a specific size.
  * @name: Human-readable name for debugging (e.g., "task_structs").
- * @size: The size of each object in this cache.
+ * @size: The distance between objects in a slab.
+ * @object_size: The size the cache was created with.
+ * @offset: Where in a free object the free list link is kept.
  * @align: The required alignment for each object.
- * @ctor: Optional constructor to run on new objects.
- * @dtor: Optional destructor to run when objects are freed.
+ * @flags: SLAB_* flags the cache was created with.
+ * @ctor: Optional constructor, run once per object when its slab is made.
+ * @dtor: Optional destructor, run once per object when its slab is freed.
  * @partial: A list of slabs that are partially full.
  * @full: A list of slabs that have no free objects.
  * @free: A list of slabs that are completely empty.
  * @nr_free_slabs: A count of slabs on the `free` list, for quick reclamation.
+ * @slabs_created: Slabs made since the cache was created.
+ * @slabs_released: Slabs given back to the page allocator since then.
+ * @order: Each slab is 2^order pages.
+ * @objects: The number of objects that fit in one slab.
+ * @waste: Bytes per slab that don't hold objects.
+ * @colour: How many different offsets the first object of a slab can take.
+ * @colour_off: The step between two offsets, one cache line or @align.
+ * @colour_next: The offset, in @colour_off steps, the next slab will use.
+ * @lock: Protects the slab lists and the slabs on them.
+ * @cpu_cache: The per-CPU magazines that sit in front of the slab lists.
+ * @list: Entry in the list of all caches, walked by the slab shrinker.
  */
 struct kmem_cache {
 	const char *name;
 	size_t size;
+	size_t object_size;
+	size_t offset;
 	size_t align;
+	unsigned long flags;
 	void (*ctor)(void *);
 	void (*dtor)(void *);
 	struct list_head partial;
 	struct list_head full;
 	struct list_head free;
 	unsigned int nr_free_slabs;
+	unsigned long slabs_created;
+	unsigned long slabs_released;
+	u32 order;
+	unsigned int objects;
+	size_t waste;
+	unsigned int colour;
+	unsigned int colour_off;
+	unsigned int colour_next;
+	spinlock_t lock;
+	struct array_cache cpu_cache[NR_CPUS];
+	struct list_head list;
 };
 
 /**
- * struct slab - A container for one or more objects.
- * @list: Links this slab into one of the `kmem_cache` lists (partial, full,
- * free).
- * @cache: A back-pointer to the cache this slab belongs to.
- * @inuse: The number of objects currently allocated from this slab.
- * @total: The total number of objects this slab can hold.
- * @free_list: A simple, singly-linked list of the free objects within this
- * slab.
- * @page: A pointer to the `struct page` that this slab lives in.
- * @magic: The magic number for validation (SLAB_PAGE_MAGIC).
+ * virt_to_slab_page - Find the slab an object lives in.
+ * @addr: Any address inside the slab
+ *
+ * A slab is described by the `struct page` of its first page. Every page of
+ * a slab has PG_slab set and the slab's order in `order`, and slabs are
+ * naturally aligned, so we get there by rounding the PFN down. The object's
+ * memory is never read. Returns NULL if @addr is not in a slab.
  */
-struct slab {
-	struct list_head list;
-	struct kmem_cache *cache;
-	u16 inuse;
-	u16 total;
-	void *free_list;
-	struct page *page;
-	u32 magic;
-};
+static inline struct page *virt_to_slab_page(const void *addr) {
+	struct page *pg = virt_to_page((void *)addr);
+	u64 mask;
 
-struct page_alloc_hdr {
-	u32 magic;
-	u32 order;
-	struct page *first_page;
-};
+	if (!pg || !(pg->flags & PG_slab))
+		return NULL;
+
+	mask = (1UL << pg->order) - 1;
+	if (pg->pfn & mask)
+		pg = phys_to_page(PFN_PHYS(pg->pfn & ~mask));
+	return pg;
+}
 
 /**
  * kmem_cache_create - Create a new slab cache for objects of a specific size
  * @name: A human-readable name for the cache
  * @size: The size of each object to be stored in the cache
  * @align: The required alignment for the objects
+ * @flags: SLAB_HWCACHE_ALIGN to start every object on a cache line of its own
  * @ctor: A constructor function to be called on new objects.
  * @dtor: A destructor function to be called on objects before they are freed.
  *
+ * Objects are constructed once, when the slab they live in is created, and
+ * destructed once, when that slab goes back to the page allocator. In
+ * between they go in and out of the cache as they are, so callers must free
+ * objects in their constructed state. @ctor runs under the cache lock and
+ * must not allocate from this cache.
+ *
  * Returns a pointer to the newly created `struct kmem_cache` on success,
  * or NULL on failure.
  */
 struct kmem_cache *kmem_cache_create(const char *name, size_t size,
-				     size_t align, void (*ctor)(void *),
+				     size_t align, unsigned long flags,
+				     void (*ctor)(void *),
 				     void (*dtor)(void *));
 
 /**
@@ -111,6 +204,159 @@ void *kmem_cache_alloc(struct kmem_cache *cache);
  */
 void kmem_cache_free(struct kmem_cache *cache, void *objp);
 
+/**
+ * kmem_cache_alloc_bulk - Allocate several objects from a slab cache.
+ * @cache: The cache from which to allocate the objects.
+ * @nr: How many objects to allocate.
+ * @p: Filled with the objects.
+ *
+ * Empties this CPU's magazine first and then takes whole runs off each
+ * slab's free list under a single hold of the cache lock. It's all or
+ * nothing: returns @nr on success, or 0 with nothing allocated.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *cache, size_t nr, void **p);
+
+/**
+ * kmem_cache_free_bulk - Free several objects back to their slab cache.
+ * @cache: The cache to which the objects belong.
+ * @nr: How many objects there are.
+ * @p: The objects, none of which may be NULL.
+ *
+ * Tops up this CPU's magazine and gives the rest back to their slabs under
+ * a single hold of the cache lock. Objects from the same slab that sit next
+ * to each other in @p are freed together.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *cache, size_t nr, void **p);
+
+/**
+ * struct kmem_cache_stats - A snapshot of a cache's usage, slabinfo style
+ * @active_objs: Objects handed out and not freed yet
+ * @total_objs: Objects the cache's slabs have room for
+ * @nr_full: Slabs with no free objects
+ * @nr_partial: Slabs with some free objects
+ * @nr_free: Slabs with no objects in use
+ * @allocs: Objects allocated, summed over all CPUs
+ * @frees: Objects freed, summed over all CPUs
+ * @slabs_created: Slabs made so far
+ * @slabs_released: Slabs given back to the page allocator so far
+ * @bytes_wasted: Slab memory that can't hold objects, plus the padding
+ *                added to each object for alignment or the free list link
+ */
+struct kmem_cache_stats {
+	unsigned long active_objs;
+	unsigned long total_objs;
+	unsigned long nr_full;
+	unsigned long nr_partial;
+	unsigned long nr_free;
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long slabs_created;
+	unsigned long slabs_released;
+	unsigned long bytes_wasted;
+};
+
+/**
+ * kmem_cache_get_stats - Read the usage counters of a cache.
+ * @cache: The cache
+ * @stats: Filled out with a snapshot of the counters
+ *
+ * The alloc and free counters are kept per CPU, so keeping them costs the
+ * fast path nothing but an increment. This sums them up and counts the
+ * slabs under the cache lock.
+ */
+void kmem_cache_get_stats(struct kmem_cache *cache,
+			  struct kmem_cache_stats *stats);
+
+/**
+ * slabinfo_show - Print a line of statistics for every cache.
+ *
+ * Also what reading the "slabinfo" device does.
+ */
+void slabinfo_show(void);
+
+/**
+ * kmalloc_index - Class index for a kmalloc() of @size bytes.
+ * @size: Between 1 and KMALLOC_MAX_CACHE_SIZE
+ *
+ * Only meant for sizes known at compile time, where it folds down to a
+ * constant. kmalloc_size_index() is the one to use at run time.
+ */
+static __always_inline unsigned int kmalloc_index(size_t size) {
+	if (size <= 8)
+		return 0;
+	if (size <= 16)
+		return 1;
+	if (size <= 32)
+		return 2;
+	if (size <= 64)
+		return 3;
+	if (size <= 96)
+		return 4;
+	if (size <= 128)
+		return 5;
+	if (size <= 192)
+		return 6;
+	if (size <= 256)
+		return 7;
+	if (size <= 384)
+		return 8;
+	if (size <= 512)
+		return 9;
+	if (size <= 1024)
+		return 10;
+	if (size <= 2048)
+		return 11;
+	return 12;
+}
+
+/**
+ * kmalloc_size_index - Class index for a kmalloc() of @size bytes.
+ * @size: Between 1 and KMALLOC_MAX_CACHE_SIZE
+ *
+ * A table lookup for small sizes and a count-leading-zeros above that.
+ * Panics if @size is out of range.
+ */
+unsigned int kmalloc_size_index(size_t size);
+
+/**
+ * kmalloc_class_alloc - Allocate from a kmalloc class.
+ * @idx: The class, from kmalloc_index() or kmalloc_size_index()
+ * @size: The size that was asked for, for the histograms
+ */
+void *kmalloc_class_alloc(unsigned int idx, size_t size);
+
+/**
+ * struct kmalloc_class_stats - Request counters for one kmalloc class
+ * @size: The object size of the class
+ * @requests: kmalloc() calls served by the class
+ * @bytes: Bytes asked for in total, to compare with @requests * @size
+ * @hist: Requests by size. The range between the next smaller class and
+ *        @size is cut into KMALLOC_HIST_BUCKETS equal parts, smallest first.
+ *
+ * Each CPU keeps its own; kmalloc_get_class_stats() adds them up.
+ */
+struct kmalloc_class_stats {
+	size_t size;
+	unsigned long requests;
+	unsigned long bytes;
+	unsigned long hist[KMALLOC_HIST_BUCKETS];
+};
+
+/**
+ * kmalloc_get_class_stats - Read the counters of a kmalloc class.
+ * @idx: The class
+ * @stats: Filled out with a snapshot of the counters
+ *
+ * Returns 0 on success or -1 if @idx is out of range.
+ */
+int kmalloc_get_class_stats(unsigned int idx,
+			    struct kmalloc_class_stats *stats);
+
+/**
+ * kmalloc_dump_stats - Print the request histogram of every kmalloc class.
+ */
+void kmalloc_dump_stats(void);
+
 /**
  * slab_get_kmalloc_cache - Find a general-purpose cache for a given size.
  */
@@ -20,4 +20,18 @@ void timer_init(void);
  */
 u64 timer_get_uptime_ms(void);
 
+/**
+ * pit_oneshot_start - Start a one-shot countdown on PIT channel 2
+ * @count: Input clock ticks to count down, at TIMER_FREQUENCY
+ *
+ * Channel 0 keeps driving the system tick, so this is safe to use at any
+ * time. Poll pit_oneshot_expired() to find out when it is done.
+ */
+void pit_oneshot_start(u16 count);
+
+/**
+ * pit_oneshot_expired - Check whether the channel 2 countdown has finished
+ */
+bool pit_oneshot_expired(void);
+
 #endif
\ No newline at end of file
@@ -3,13 +3,45 @@
 #ifndef _SEREN_SCHED_H
 #define _SEREN_SCHED_H
 
+#include <lib/rbtree.h>
+#include <seren/list.h>
 #include <seren/types.h>
 
 #define KERNEL_TASK_NAME "kernel_idle"
 #define MAX_TASKS	 1337
 
+/**
+ * Task priorities run from 0 (most urgent) to MAX_PRIO - 1. Each run queue
+ * keeps one bit per priority in a single word, so MAX_PRIO can't go above
+ * 64.
+ */
+#define MAX_PRIO     64
+#define DEFAULT_PRIO 32
+
+/* Nice values of fair tasks; lower gets a bigger share of the CPU. */
+#define MIN_NICE -20
+#define MAX_NICE 19
+
 typedef s32 pid_t;
 
+struct sched_class;
+
+/**
+ * struct sched_entity - What the fair class tracks for each task
+ * @run_node: Link in the run queue's tree, ordered by @vruntime
+ * @weight: Load weight derived from the nice value
+ * @vruntime: Time run so far, scaled by NICE_0_LOAD / @weight, in ns
+ * @sum_exec_runtime: Time actually run so far, in ns
+ * @prev_sum_exec_runtime: @sum_exec_runtime when the task was last picked
+ */
+struct sched_entity {
+	struct rb_node run_node;
+	unsigned long weight;
+	u64 vruntime;
+	u64 sum_exec_runtime;
+	u64 prev_sum_exec_runtime;
+};
+
 typedef enum {
 	TASK_STATE_DEAD = 0,
 	TASK_STATE_RUNNING,
@@ -25,6 +57,24 @@ typedef struct task {
 	uintptr_t stack_ptr;
 
 	uintptr_t stack_base;
+
+	/* CPU whose run queue holds the task, and the link in that queue. */
+	unsigned int cpu;
+	struct list_head run_list;
+
+	/* Still running on its CPU's stack; must not migrate until cleared. */
+	int on_cpu;
+
+	/* Scheduling class, which decides which of the fields below count. */
+	const struct sched_class *sched_class;
+
+	/* Round-robin: priority, and ticks left before it has to yield. */
+	int prio;
+	unsigned int time_slice;
+
+	/* Fair: nice value and virtual runtime. */
+	int nice;
+	struct sched_entity se;
 } task_t;
 
 /**
@@ -32,14 +82,125 @@ typedef struct task {
  */
 void sched_init(void);
 
+/**
+ * sched_init_cpu - Set up the run queue of an application processor
+ * @cpu: Logical number of the calling CPU
+ *
+ * The caller becomes the idle task of @cpu.
+ */
+void sched_init_cpu(unsigned int cpu);
+
 /**
  * create_task - Creates a new kernel task.
+ *
+ * The task joins the fair class with a nice value of 0 and is queued on the
+ * online CPU with the fewest runnable tasks.
  */
 pid_t create_task(const char *name, void (*entry_point)(void));
 
+/**
+ * create_task_nice - Creates a new fair-class kernel task.
+ * @nice: Between MIN_NICE and MAX_NICE
+ */
+pid_t create_task_nice(const char *name, void (*entry_point)(void), int nice);
+
+/**
+ * create_task_prio - Creates a new round-robin kernel task.
+ * @prio: Between 0 (most urgent) and MAX_PRIO - 1
+ *
+ * Round-robin tasks always run ahead of fair ones.
+ */
+pid_t create_task_prio(const char *name, void (*entry_point)(void), int prio);
+
 /**
  * schedule - The main scheduler function, called by the timer interrupt.
+ *
+ * Only looks at the run queue of the CPU it runs on.
  */
 uintptr_t schedule(uintptr_t);
 
+/**
+ * current_task - The task running on the calling CPU
+ */
+task_t *current_task(void);
+
+/**
+ * set_current_state - Change the state of the running task
+ * @state: TASK_STATE_RUNNING or TASK_STATE_BLOCKED
+ *
+ * A blocked task keeps the CPU until it yields, and only then leaves the run
+ * queue.
+ */
+void set_current_state(task_state_t state);
+
+/**
+ * wake_up_process - Make a blocked task runnable again
+ * @p: The task
+ *
+ * Safe to call from interrupt handlers.
+ *
+ * Returns 1 if @p was blocked, 0 otherwise.
+ */
+int wake_up_process(task_t *p);
+
+/**
+ * schedule_yield - Give up the CPU right away
+ *
+ * Runs schedule() through SCHED_YIELD_VECTOR instead of waiting for the next
+ * timer tick. A blocked caller leaves the run queue until it is woken.
+ */
+void schedule_yield(void);
+
+/**
+ * sched_yield_interrupt - Mark the coming schedule() call as a yield
+ *
+ * Called by the SCHED_YIELD_VECTOR handler before it switches tasks.
+ */
+void sched_yield_interrupt(void);
+
+/**
+ * finish_task_switch - Called once schedule()'s new stack is loaded.
+ *
+ * Until then the CPU is still running on the previous task's stack, so that
+ * task may not be picked up by another CPU yet.
+ */
+void finish_task_switch(void);
+
+/**
+ * struct sched_stats - Scheduler counters of one CPU
+ * @nr_running: Runnable tasks, the running one included
+ * @load_avg: Moving average of @nr_running, scaled by SCHED_LOAD_SCALE
+ * @nr_switches: Context switches
+ * @nr_steals: Tasks taken from another CPU while this one was idle
+ * @nr_steal_fails: Idle steals given up because the other queue was busy
+ * @nr_migrations: Tasks pulled in by periodic rebalancing
+ */
+struct sched_stats {
+	unsigned long nr_running;
+	unsigned long load_avg;
+	unsigned long nr_switches;
+	unsigned long nr_steals;
+	unsigned long nr_steal_fails;
+	unsigned long nr_migrations;
+};
+
+#define SCHED_LOAD_SHIFT 11
+#define SCHED_LOAD_SCALE (1UL << SCHED_LOAD_SHIFT)
+
+/**
+ * sched_get_stats - Read the scheduler counters of a CPU
+ * @cpu: Logical CPU number
+ * @stats: Filled out with a snapshot of the counters
+ *
+ * Returns 0, or -1 if @cpu is not online.
+ */
+int sched_get_stats(unsigned int cpu, struct sched_stats *stats);
+
+/**
+ * schedstat_show - Print the scheduler counters of every online CPU.
+ *
+ * Also what reading the "schedstat" device does.
+ */
+void schedstat_show(void);
+
 #endif // _SEREN_SCHED_H
\ No newline at end of file
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SEREN_SMP_H
+#define _SEREN_SMP_H
+
+#include <asm/smp.h>
+#include <seren/config.h>
+#include <seren/types.h>
+
+/**
+ * smp_processor_id - Index of the CPU we are currently running on
+ *
+ * Per-CPU data should be indexed through it. The result is only stable
+ * while interrupts are disabled, since nothing pins a task to a CPU yet.
+ */
+static inline unsigned int smp_processor_id(void) {
+	return arch_smp_processor_id();
+}
+
+/**
+ * cpu_online - Check whether a CPU is up and scheduling tasks
+ * @cpu: Logical CPU number
+ */
+static inline bool cpu_online(unsigned int cpu) {
+	return cpu < NR_CPUS && cpu_data[cpu].online;
+}
+
+/**
+ * num_online_cpus - Number of CPUs that are currently scheduling tasks
+ */
+unsigned int num_online_cpus(void);
+
+/**
+ * smp_init - Start the application processors
+ *
+ * Must be called on the bootstrap processor after sched_init(). CPUs that
+ * fail to come up are simply left parked.
+ */
+void smp_init(void);
+
+#endif // _SEREN_SMP_H
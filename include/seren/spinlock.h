@@ -19,6 +19,16 @@ static inline void spin_init(spinlock_t *lock) { arch_spin_init(lock); }
  */
 static inline void spin_lock(spinlock_t *lock) { arch_spin_lock(lock); }
 
+/**
+ * spin_trylock - Acquire a spinlock without spinning.
+ * @lock: The spinlock to acquire.
+ *
+ * Returns 1 if the lock was taken, 0 if it is held by someone else.
+ */
+static inline int spin_trylock(spinlock_t *lock) {
+	return arch_spin_trylock(lock);
+}
+
 /**
  * spin_unlock - Release a previously acquired spinlock.
  * @lock: The spinlock to release.
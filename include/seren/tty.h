@@ -3,9 +3,25 @@
 #ifndef _SEREN_TTY_H
 #define _SEREN_TTY_H
 
+#include <seren/types.h>
+
+/* Longest line the TTY keeps, terminating NUL included. */
+#define TTY_LINE_MAX 256
+
 /**
  * tty_receive_char - Pushes a character from an input device to the TTY layer.
  */
 void tty_receive_char(char c);
 
+/**
+ * tty_read_line - Sleep until a line is entered and copy it out
+ * @buf: Where to put the line, without its newline and NUL-terminated
+ * @size: Size of @buf; longer lines are cut short
+ *
+ * Must be called from a task. Each line goes to one reader only.
+ *
+ * Returns the length of the line stored in @buf.
+ */
+size_t tty_read_line(char *buf, size_t size);
+
 #endif // _SEREN_CONSOLE_H
\ No newline at end of file
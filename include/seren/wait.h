@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SEREN_WAIT_H
+#define _SEREN_WAIT_H
+
+#include <seren/list.h>
+#include <seren/sched/sched.h>
+#include <seren/spinlock.h>
+
+/**
+ * struct wait_queue_entry - A task sleeping on a wait queue
+ * @task: The sleeping task
+ * @entry: Link in the wait queue; empty once the task has been woken
+ */
+struct wait_queue_entry {
+	task_t *task;
+	struct list_head entry;
+};
+
+/**
+ * struct wait_queue_head - Tasks waiting for the same event
+ * @lock: Protects @head; may be taken from interrupt handlers
+ * @head: The waiting tasks' entries
+ */
+typedef struct wait_queue_head {
+	spinlock_t lock;
+	struct list_head head;
+} wait_queue_head_t;
+
+#define WAIT_QUEUE_HEAD_INIT(name)                                             \
+	{.lock = SPIN_LOCK_UNLOCKED, .head = LIST_HEAD_INIT((name).head)}
+
+#define DECLARE_WAIT_QUEUE_HEAD(name)                                          \
+	wait_queue_head_t name = WAIT_QUEUE_HEAD_INIT(name)
+
+/**
+ * init_waitqueue_head - Initialize a wait queue at runtime
+ * @wq: The wait queue
+ */
+void init_waitqueue_head(wait_queue_head_t *wq);
+
+/**
+ * init_wait_entry - Initialize a wait queue entry for the current task
+ * @wait: The entry, usually on the waiter's stack
+ */
+void init_wait_entry(struct wait_queue_entry *wait);
+
+/**
+ * prepare_to_wait - Queue the current task and mark it blocked
+ * @wq: The wait queue
+ * @wait: The current task's entry
+ *
+ * The task keeps running until it calls schedule_yield(). Check the wait
+ * condition in between; if it already holds, call finish_wait() instead.
+ */
+void prepare_to_wait(wait_queue_head_t *wq, struct wait_queue_entry *wait);
+
+/**
+ * finish_wait - Mark the current task running and leave the wait queue
+ * @wq: The wait queue
+ * @wait: The current task's entry
+ */
+void finish_wait(wait_queue_head_t *wq, struct wait_queue_entry *wait);
+
+/**
+ * wake_up - Wake every task waiting on a wait queue
+ * @wq: The wait queue
+ *
+ * Safe to call from interrupt handlers. Woken tasks are taken off @wq and
+ * go back on the run queue of the CPU they slept on.
+ *
+ * Returns the number of tasks woken.
+ */
+int wake_up(wait_queue_head_t *wq);
+
+/**
+ * wait_event - Sleep until a condition becomes true
+ * @wq: The wait queue that is woken when @condition may have changed
+ * @condition: C expression, re-checked after every wakeup
+ *
+ * Must be called from a task, not from an interrupt handler or the idle
+ * task. Whoever makes @condition true has to call wake_up(&@wq) afterwards.
+ */
+#define wait_event(wq, condition)                                              \
+	do {                                                                   \
+		struct wait_queue_entry __wait;                                \
+                                                                               \
+		init_wait_entry(&__wait);                                      \
+		for (;;) {                                                     \
+			prepare_to_wait(&(wq), &__wait);                       \
+			if (condition)                                         \
+				break;                                         \
+			schedule_yield();                                      \
+		}                                                              \
+		finish_wait(&(wq), &__wait);                                   \
+	} while (0)
+
+#endif // _SEREN_WAIT_H
@@ -10,16 +10,19 @@
 #include <lib/string.h>
 #include <limine.h>
 #include <pic.h>
+#include <seren/config.h>
 #include <seren/fs/vfs.h>
 #include <seren/init.h>
 #include <seren/input.h>
 #include <seren/interrupt.h>
 #include <seren/mm/pmm.h>
+#include <seren/mm/prezero.h>
 #include <seren/mm/slab.h>
 #include <seren/panic.h>
 #include <seren/pit.h>
 #include <seren/printk.h>
 #include <seren/sched/sched.h>
+#include <seren/smp.h>
 #include <seren/tty.h>
 #include <seren/types.h>
 
@@ -41,6 +44,19 @@ volatile struct limine_memmap_request memmap_request = {
 	.id = LIMINE_MEMMAP_REQUEST,
 	.revision = 0
 };
+
+__attribute__((used, section(".limine_requests")))
+volatile struct limine_kernel_address_request kernel_address_request = {
+	.id = LIMINE_KERNEL_ADDRESS_REQUEST,
+	.revision = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+volatile struct limine_smp_request smp_request = {
+	.id = LIMINE_SMP_REQUEST,
+	.revision = 0,
+	.flags = LIMINE_SMP_X2APIC
+};
 // clang-format on
 
 static void do_initcalls(void) {
@@ -53,18 +69,62 @@ static void do_initcalls(void) {
 	}
 }
 
+/* Physical address of a symbol in the kernel image. */
+static phys_addr_t kernel_virt_to_phys(void *addr) {
+	struct limine_kernel_address_response *resp =
+	    kernel_address_request.response;
+
+	if (resp)
+		return resp->physical_base +
+		       ((uintptr_t)addr - resp->virtual_base);
+
+	return KERNEL_PHYSICAL_LOAD_ADDR +
+	       ((uintptr_t)addr - KERNEL_VIRTUAL_BASE);
+}
+
+/**
+ * free_initmem - Give the .init sections back to the page allocator.
+ *
+ * Everything marked `__init`, along with the initcall table, is dead once
+ * do_initcalls() returns. This must not be `__init` itself.
+ */
+static void free_initmem(void) {
+	free_reserved_area(kernel_virt_to_phys(__init_begin),
+			   kernel_virt_to_phys(__init_end), "unused kernel");
+}
+
+/* Echo every line typed on the console back to the log. */
+static void tty_echo_task(void) {
+	char line[TTY_LINE_MAX];
+
+	for (;;) {
+		tty_read_line(line, sizeof(line));
+		pr_info("TTY received line: '%s'\n", line);
+	}
+}
+
 void kmain(void) {
 	do_initcalls();
+	free_initmem();
 
 	pr_info("Seren OS is booting...\n");
 	pr_info("LFB GFX, PSF Font, console initialized.\n");
 
 	sched_init();
+	smp_init();
+
+	if (create_task("tty_echo", tty_echo_task) < 0)
+		pr_warn("failed to start the TTY echo task\n");
+
+	/* Nothing has turned interrupts on yet; the timer starts ticking. */
+	local_irq_enable();
 
 	pr_info("Initialization sequence complete. You can now type. See you "
 		"<3\n");
 
+	/* Zero pages for the pool while there is nothing else to do. */
 	for (;;) {
-		__asm__ volatile("hlt");
+		if (!prezero_refill(1))
+			__asm__ volatile("hlt");
 	}
 }
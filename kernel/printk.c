@@ -8,6 +8,7 @@
 #include <lib/string.h>
 #include <seren/log.h>
 #include <seren/printk.h>
+#include <seren/spinlock.h>
 #include <seren/tty.h>
 #include <seren/types.h>
 
@@ -16,6 +17,9 @@
 static int console_loglevel = LOGLEVEL_DEBUG;
 static struct console *console_list = NULL;
 
+/* Serialises the shared format buffer and console output between CPUs. */
+static spinlock_t printk_lock = SPIN_LOCK_UNLOCKED;
+
 static int __parse_level(const char **fmt) {
 	const char *p = *fmt;
 
@@ -43,6 +47,7 @@ static void __emit_to_consoles(int level, const char *msg) {
 int vprintk(const char *fmt, va_list args) {
 	static char buf[PRINTK_BUF_SIZE];
 	const char *fmt_body;
+	u64 flags;
 	int level;
 	int len;
 
@@ -52,12 +57,15 @@ int vprintk(const char *fmt, va_list args) {
 	fmt_body = fmt;
 	level = __parse_level(&fmt_body);
 
+	spin_lock_irqsave(&printk_lock, flags);
+
 	len = kvsnprintf(buf, PRINTK_BUF_SIZE, fmt_body, args);
-	if (len <= 0)
-		return len;
+	if (len > 0) {
+		klog_write(level, buf);
+		__emit_to_consoles(level, buf);
+	}
 
-	klog_write(level, buf);
-	__emit_to_consoles(level, buf);
+	spin_unlock_irqrestore(&printk_lock, flags);
 
 	return len;
 }
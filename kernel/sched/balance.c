@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#define pr_fmt(fmt) "sched: " fmt
+
+#include <seren/smp.h>
+
+#include "sched.h"
+
+/**
+ * Both the idle steal and the periodic pull run from the timer tick with
+ * the local queue already locked. The other queue is only ever trylocked:
+ * two CPUs pulling from each other can't deadlock, and a CPU never spins in
+ * interrupt context behind a busy neighbour. A failed attempt is simply
+ * tried again on a later tick.
+ */
+
+/*
+ * Pick the CPU to take work from: the one with the most runnable tasks, or
+ * the highest load average if @by_load. Only CPUs with a task waiting
+ * behind the running one are considered. Reads are racy but only a hint.
+ */
+static struct rq *__find_busiest(struct rq *rq, bool by_load) {
+	struct rq *busiest = NULL;
+
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct rq *other = &runqueues[cpu];
+
+		if (cpu == rq->cpu || !cpu_online(cpu) ||
+		    other->nr_running < 2)
+			continue;
+
+		if (!busiest ||
+		    (by_load ? other->load_avg > busiest->load_avg
+			     : other->nr_running > busiest->nr_running))
+			busiest = other;
+	}
+
+	return busiest;
+}
+
+/*
+ * Take a task off @src so it can move. Each class gives up its least urgent
+ * task rather than the one @src would run next, which is most likely to
+ * still be warm in @src's caches. Returns NULL if no task can move.
+ */
+static task_t *__detach_task(struct rq *src) {
+	for (const struct sched_class *c = sched_class_highest; c;
+	     c = c->next) {
+		task_t *p = c->detach_task(src);
+
+		if (p) {
+			src->nr_running--;
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static void __attach_task(struct rq *dst, task_t *p) {
+	p->cpu = dst->cpu;
+	p->sched_class->enqueue_task(dst, p, ENQUEUE_MIGRATED);
+	dst->nr_running++;
+}
+
+/* Move one task from @src to @rq. Returns true on success. */
+static bool __pull_task(struct rq *rq, struct rq *src) {
+	task_t *p;
+
+	if (!spin_trylock(&src->lock))
+		return false;
+	p = __detach_task(src);
+	spin_unlock(&src->lock);
+
+	if (!p)
+		return false;
+
+	__attach_task(rq, p);
+	return true;
+}
+
+bool sched_steal_task(struct rq *rq) {
+	struct rq *busiest = __find_busiest(rq, false);
+
+	if (!busiest)
+		return false;
+
+	if (!__pull_task(rq, busiest)) {
+		rq->nr_steal_fails++;
+		return false;
+	}
+
+	rq->nr_steals++;
+	return true;
+}
+
+void sched_balance_tick(struct rq *rq) {
+	unsigned long target = rq->nr_running << SCHED_LOAD_SHIFT;
+	unsigned long sum;
+	struct rq *busiest;
+
+	/**
+	 * Exponential moving average, one step per tick. Rounding toward the
+	 * target lets it actually get there, in particular down to 0 on an
+	 * idle CPU; plain truncation would leave it stuck short.
+	 */
+	sum = (rq->load_avg << SCHED_LOAD_AVG_SHIFT) - rq->load_avg + target;
+	if (target > rq->load_avg)
+		sum += (1UL << SCHED_LOAD_AVG_SHIFT) - 1;
+	rq->load_avg = sum >> SCHED_LOAD_AVG_SHIFT;
+
+	if (++rq->nr_ticks % SCHED_BALANCE_INTERVAL)
+		return;
+
+	/**
+	 * The averages say whether the imbalance has lasted; the instant
+	 * counts say whether moving a task right now actually evens it out.
+	 */
+	busiest = __find_busiest(rq, true);
+	if (!busiest ||
+	    busiest->load_avg < rq->load_avg + SCHED_BALANCE_THRESHOLD ||
+	    busiest->nr_running < rq->nr_running + 2)
+		return;
+
+	if (__pull_task(rq, busiest))
+		rq->nr_migrations++;
+}
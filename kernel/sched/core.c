@@ -6,29 +6,69 @@
 #define pr_fmt(fmt) "sched: " fmt
 
 #include <asm/gdt.h>
+#include <asm/irq_vectors.h>
 #include <lib/string.h>
+#include <seren/fs/devicefs.h>
+#include <seren/init.h>
 #include <seren/mm/pmm.h>
+#include <seren/mm/prezero.h>
 #include <seren/panic.h>
 #include <seren/printk.h>
 #include <seren/sched/sched.h>
+#include <seren/smp.h>
+#include <seren/spinlock.h>
+
+#include "sched.h"
+
+struct rq runqueues[NR_CPUS];
 
 static task_t g_task_table[MAX_TASKS];
-static volatile pid_t g_current_task_id = 0;
-static volatile pid_t g_highest_pid = 0;
+static pid_t g_highest_pid = 0;
+static spinlock_t task_table_lock = SPIN_LOCK_UNLOCKED;
+
+static inline struct rq *this_rq(void) {
+	return &runqueues[smp_processor_id()];
+}
+
+/* Whether a class above @class (any class, if NULL) has a task waiting. */
+static bool __higher_class_ready(struct rq *rq,
+				 const struct sched_class *class) {
+	for (const struct sched_class *c = sched_class_highest; c != class;
+	     c = c->next) {
+		if (c->has_ready(rq))
+			return true;
+	}
+
+	return false;
+}
+
+/* Take the next task off the highest class that has one ready. */
+static task_t *__pick_next_task(struct rq *rq) {
+	for (const struct sched_class *c = sched_class_highest; c;
+	     c = c->next) {
+		task_t *p = c->pick_next_task(rq);
+		if (p)
+			return p;
+	}
+
+	return NULL;
+}
 
 /**
  * task_exit - The default exit point for a task.
  *
  * If a task function returns its RIP will land here. We mark the task as
- * dead and then put the CPU to sleep in a loop. A real scheduler would clean up
- * its resources (like the stack) here.
+ * dead and then put the CPU to sleep in a loop; the next schedule() on this
+ * CPU drops it from the run queue. A real scheduler would clean up its
+ * resources (like the stack) here.
  */
 static void task_exit(void) {
-	pr_debug("task %u ('%s') is exiting\n", g_current_task_id,
-		 g_task_table[g_current_task_id].name);
+	task_t *curr;
 
 	local_irq_disable();
-	g_task_table[g_current_task_id].state = TASK_STATE_DEAD;
+	curr = this_rq()->curr;
+	pr_debug("task %u ('%s') is exiting\n", curr->id, curr->name);
+	curr->state = TASK_STATE_DEAD;
 	local_irq_enable();
 
 	while (1) {
@@ -36,45 +76,116 @@ static void task_exit(void) {
 	}
 }
 
+/* Take the next free slot of the task table, or NULL if it is full. */
+static task_t *__alloc_task(const char *name) {
+	task_t *task = NULL;
+	u64 flags;
+
+	// TODO: Right now we just increment PIDs. We should reuse slots from
+	// DEAD tasks.
+	spin_lock_irqsave(&task_table_lock, flags);
+	if (g_highest_pid < MAX_TASKS) {
+		task = &g_task_table[g_highest_pid];
+		task->id = g_highest_pid++;
+		task->name = name;
+	}
+	spin_unlock_irqrestore(&task_table_lock, flags);
+
+	return task;
+}
+
+/* Set up @cpu's run queue with the caller as its idle task. */
+static task_t *__init_rq(unsigned int cpu) {
+	struct rq *rq = &runqueues[cpu];
+	task_t *idle = __alloc_task(KERNEL_TASK_NAME);
+
+	if (!idle)
+		panic("no task slot left for the idle task of CPU%u", cpu);
+
+	idle->cpu = cpu;
+	idle->state = TASK_STATE_RUNNING;
+	idle->on_cpu = 1;
+	INIT_LIST_HEAD(&idle->run_list);
+
+	spin_init(&rq->lock);
+	rq->cpu = cpu;
+	rq->prev = NULL;
+	rq->yield = false;
+	for (const struct sched_class *c = sched_class_highest; c;
+	     c = c->next)
+		c->init_rq(rq);
+	rq->curr = idle;
+	rq->idle = idle;
+	rq->nr_running = 0;
+	rq->load_avg = 0;
+	rq->nr_ticks = 0;
+	rq->nr_switches = 0;
+	rq->nr_steals = 0;
+	rq->nr_steal_fails = 0;
+	rq->nr_migrations = 0;
+
+	return idle;
+}
+
 void sched_init(void) {
 	memset(g_task_table, 0, sizeof(g_task_table));
 
-	pid_t idle_pid = g_highest_pid++;
-	task_t *idle_task = &g_task_table[idle_pid];
+	task_t *idle_task = __init_rq(0);
 
-	idle_task->id = idle_pid;
-	idle_task->name = KERNEL_TASK_NAME;
-	idle_task->state = TASK_STATE_RUNNING;
-	g_current_task_id = idle_pid;
+	pr_info("initialized; idle task created with PID %u\n", idle_task->id);
+}
 
-	pr_info("initialized; idle task created with PID %u\n",
-		g_current_task_id);
+void sched_init_cpu(unsigned int cpu) {
+	task_t *idle_task = __init_rq(cpu);
+
+	pr_info("CPU%u: idle task created with PID %u\n", cpu, idle_task->id);
 }
 
-pid_t create_task(const char *name, void (*entry_point)(void)) {
-	u64 flags = local_irq_save();
+/*
+ * Pick the online CPU with the fewest runnable tasks. The counts are read
+ * without the queue locks, which is fine for a placement hint.
+ */
+static unsigned int __select_cpu(void) {
+	unsigned int best = 0;
 
-	pid_t new_pid = -1;
-	// TODO: Right now we just increment PIDs. We should reuse slots from
-	// DEAD tasks.
-	if (g_highest_pid >= MAX_TASKS) {
-		pr_err("failed to create task '%s': max tasks reached\n", name);
-		local_irq_restore(flags);
-		return -1;
+	for (unsigned int cpu = 1; cpu < NR_CPUS; cpu++) {
+		if (cpu_online(cpu) &&
+		    runqueues[cpu].nr_running < runqueues[best].nr_running)
+			best = cpu;
 	}
 
-	new_pid = g_highest_pid++;
+	return best;
+}
+
+static void __enqueue_task(task_t *task, unsigned int cpu) {
+	struct rq *rq = &runqueues[cpu];
+	u64 flags;
 
-	task_t *new_task = &g_task_table[new_pid];
-	new_task->id = new_pid;
-	new_task->name = name;
+	spin_lock_irqsave(&rq->lock, flags);
+	task->cpu = cpu;
+	task->state = TASK_STATE_READY;
+	task->sched_class->enqueue_task(rq, task, ENQUEUE_NEW);
+	rq->nr_running++;
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
 
-	struct page *stack_page = alloc_page();
+/*
+ * Build a task around @entry_point and queue it. @class and @param (the
+ * priority or nice value) have been checked by the caller.
+ */
+static pid_t __create_task(const char *name, void (*entry_point)(void),
+			   const struct sched_class *class, int param) {
+	struct page *stack_page = alloc_page_zeroed();
 	if (!stack_page) {
 		pr_err("failed to create task '%s': out of physical memory\n",
 		       name);
-		g_highest_pid--;
-		local_irq_restore(flags);
+		return -1;
+	}
+
+	task_t *new_task = __alloc_task(name);
+	if (!new_task) {
+		pr_err("failed to create task '%s': max tasks reached\n", name);
+		free_page(stack_page);
 		return -1;
 	}
 
@@ -86,11 +197,11 @@ pid_t create_task(const char *name, void (*entry_point)(void)) {
 	/**
 	 * We'll build a fake interrupt frame at the very top of the new task's
 	 * stack. This `pt_regs` struct is what the `iretq` instruction expects
-	 * to see when we "return" to this task.
+	 * to see when we "return" to this task. The stack page comes zeroed, so
+	 * every register we don't set below starts out as 0.
 	 */
 	struct pt_regs *context =
 	    (struct pt_regs *)(stack_top - sizeof(struct pt_regs));
-	memset(context, 0, sizeof(struct pt_regs));
 
 	/*
 	 * We also need to push a "return address" onto the stack for the entry
@@ -108,47 +219,250 @@ pid_t create_task(const char *name, void (*entry_point)(void)) {
 	context->ss = GDT_KERNEL_DATA_SELECTOR;
 
 	new_task->stack_ptr = (uintptr_t)context;
-	new_task->state = TASK_STATE_READY;
 
-	pr_info("created task '%s' with PID %u\n", name, new_pid);
+	if (class == &rr_sched_class)
+		rr_task_init(new_task, param);
+	else
+		fair_task_init(new_task, param);
 
-	local_irq_restore(flags);
-	return new_pid;
+	unsigned int cpu = __select_cpu();
+	__enqueue_task(new_task, cpu);
+
+	pr_info("created task '%s' with PID %u on CPU%u\n", name, new_task->id,
+		cpu);
+
+	return new_task->id;
+}
+
+pid_t create_task(const char *name, void (*entry_point)(void)) {
+	return create_task_nice(name, entry_point, 0);
+}
+
+pid_t create_task_nice(const char *name, void (*entry_point)(void), int nice) {
+	if (nice < MIN_NICE || nice > MAX_NICE) {
+		pr_err("failed to create task '%s': bad nice value %d\n", name,
+		       nice);
+		return -1;
+	}
+
+	return __create_task(name, entry_point, &fair_sched_class, nice);
+}
+
+pid_t create_task_prio(const char *name, void (*entry_point)(void), int prio) {
+	if (prio < 0 || prio >= MAX_PRIO) {
+		pr_err("failed to create task '%s': bad priority %d\n", name,
+		       prio);
+		return -1;
+	}
+
+	return __create_task(name, entry_point, &rr_sched_class, prio);
 }
 
 /**
- * This is called from the timer interrupt handler. Its job is to save the
- * current task's state and find the next task to run.
+ * This is called from the timer interrupt handler, with interrupts off. Its
+ * job is to save the current task's state and find the next task to run on
+ * this CPU.
+ *
+ * The running task's class decides when it has had enough. Round-robin
+ * tasks always go before fair ones. When nothing is ready here, a task is
+ * stolen from the busiest CPU, and the idle task only runs if that fails.
+ *
+ * schedule_yield() gets here too, through SCHED_YIELD_VECTOR. A yield is not
+ * a tick: nothing is accounted, the running task always gives up the CPU,
+ * and a blocked one leaves the run queue until wake_up_process().
  */
 uintptr_t schedule(uintptr_t current_stack_ptr) {
-	g_task_table[g_current_task_id].stack_ptr = current_stack_ptr;
+	struct rq *rq = this_rq();
+	task_t *prev, *next;
+	bool yield;
+
+	spin_lock(&rq->lock);
+
+	prev = rq->curr;
+	prev->stack_ptr = current_stack_ptr;
+
+	yield = rq->yield;
+	rq->yield = false;
+
+	if (!yield)
+		sched_balance_tick(rq);
+
+	if (prev == rq->idle) {
+		if (!__higher_class_ready(rq, NULL) && !sched_steal_task(rq))
+			goto out;
+
+		prev->state = TASK_STATE_READY;
+	} else if (prev->state == TASK_STATE_RUNNING ||
+		   (prev->state == TASK_STATE_BLOCKED && !yield)) {
+		const struct sched_class *class = prev->sched_class;
+
+		/**
+		 * A blocked task that has not yielded yet may still be
+		 * checking its wait condition, so a tick must not put it to
+		 * sleep. If it is switched away anyway it goes back on the
+		 * queue as ready, and wait_event() simply checks again.
+		 */
+		if (!yield && !class->task_tick(rq, prev) &&
+		    !__higher_class_ready(rq, class))
+			goto out;
 
-	if (g_task_table[g_current_task_id].state == TASK_STATE_RUNNING) {
-		g_task_table[g_current_task_id].state = TASK_STATE_READY;
+		prev->state = TASK_STATE_READY;
+		class->enqueue_task(rq, prev, 0);
+	} else {
+		/* Dead, or blocked and yielding; no longer runnable here. */
+		rq->nr_running--;
+
+		if (!__higher_class_ready(rq, NULL))
+			sched_steal_task(rq);
 	}
 
-	/** Simple round-robin */
-	pid_t next_task_id = g_current_task_id;
-	for (int i = 0; i < g_highest_pid; i++) {
-		next_task_id = (next_task_id + 1) % g_highest_pid;
+	/* Tasks that died while waiting are dropped on the way. */
+	while ((next = __pick_next_task(rq)) &&
+	       next->state == TASK_STATE_DEAD)
+		rq->nr_running--;
 
-		if (next_task_id == 0)
-			continue;
+	if (!next)
+		next = rq->idle;
+
+	if (next != prev) {
+		rq->nr_switches++;
+		rq->prev = prev;
+		next->on_cpu = 1;
+	}
 
-		if (g_task_table[next_task_id].state == TASK_STATE_READY) {
-			g_current_task_id = next_task_id;
-			g_task_table[g_current_task_id].state =
-			    TASK_STATE_RUNNING;
+	next->state = TASK_STATE_RUNNING;
+	rq->curr = next;
+
+out:
+	spin_unlock(&rq->lock);
+
+	return rq->curr->stack_ptr;
+}
+
+task_t *current_task(void) {
+	task_t *curr;
+	u64 flags;
+
+	flags = local_irq_save();
+	curr = this_rq()->curr;
+	local_irq_restore(flags);
+
+	return curr;
+}
+
+void set_current_state(task_state_t state) {
+	struct rq *rq;
+	u64 flags;
+
+	flags = local_irq_save();
+	rq = this_rq();
+	spin_lock(&rq->lock);
+	rq->curr->state = state;
+	spin_unlock(&rq->lock);
+	local_irq_restore(flags);
+}
+
+int wake_up_process(task_t *p) {
+	struct rq *rq;
+	int woken = 0;
+	u64 flags;
+
+	/**
+	 * A blocked task is either running or off every queue, so it can't
+	 * migrate; but a ready one can, and may block again on another CPU
+	 * before we get the lock. Make sure we hold the lock of its CPU.
+	 */
+	for (;;) {
+		rq = &runqueues[__atomic_load_n(&p->cpu, __ATOMIC_ACQUIRE)];
+		spin_lock_irqsave(&rq->lock, flags);
+		if (rq->cpu == p->cpu)
+			break;
+		spin_unlock_irqrestore(&rq->lock, flags);
+	}
 
-			/*pr_debug("switching to task %u ('%s')\n",
-				 g_current_task_id,
-				 g_task_table[g_current_task_id].name);*/
-			// FUCKS UP THE CONSOLE SO I COMMENTED IT, BUT IT WORKS.
-			return g_task_table[g_current_task_id].stack_ptr;
+	if (p->state == TASK_STATE_BLOCKED) {
+		if (p == rq->curr) {
+			/* Hasn't yielded yet; it just keeps going. */
+			p->state = TASK_STATE_RUNNING;
+		} else {
+			p->state = TASK_STATE_READY;
+			p->sched_class->enqueue_task(rq, p, ENQUEUE_WAKEUP);
+			rq->nr_running++;
 		}
+		woken = 1;
 	}
 
-	g_current_task_id = 0;
-	g_task_table[g_current_task_id].state = TASK_STATE_RUNNING;
-	return g_task_table[g_current_task_id].stack_ptr;
-}
\ No newline at end of file
+	spin_unlock_irqrestore(&rq->lock, flags);
+
+	return woken;
+}
+
+void schedule_yield(void) {
+	__asm__ volatile("int %0" : : "i"(SCHED_YIELD_VECTOR) : "memory");
+}
+
+void sched_yield_interrupt(void) {
+	this_rq()->yield = true;
+}
+
+void finish_task_switch(void) {
+	struct rq *rq = this_rq();
+	task_t *prev = rq->prev;
+
+	if (prev) {
+		rq->prev = NULL;
+		__atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+	}
+}
+
+int sched_get_stats(unsigned int cpu, struct sched_stats *stats) {
+	struct rq *rq;
+	u64 flags;
+
+	if (!cpu_online(cpu) || !stats)
+		return -1;
+
+	rq = &runqueues[cpu];
+	spin_lock_irqsave(&rq->lock, flags);
+	stats->nr_running = rq->nr_running;
+	stats->load_avg = rq->load_avg;
+	stats->nr_switches = rq->nr_switches;
+	stats->nr_steals = rq->nr_steals;
+	stats->nr_steal_fails = rq->nr_steal_fails;
+	stats->nr_migrations = rq->nr_migrations;
+	spin_unlock_irqrestore(&rq->lock, flags);
+
+	return 0;
+}
+
+void schedstat_show(void) {
+	printk("# cpu running   load   switches   steals  failed migrations\n");
+
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct sched_stats st;
+
+		if (sched_get_stats(cpu, &st))
+			continue;
+
+		printk("%5u %7lu %3lu.%02lu %10lu %8lu %7lu %10lu\n", cpu,
+		       st.nr_running, st.load_avg >> SCHED_LOAD_SHIFT,
+		       (st.load_avg & (SCHED_LOAD_SCALE - 1)) * 100 /
+			   SCHED_LOAD_SCALE,
+		       st.nr_switches, st.nr_steals, st.nr_steal_fails,
+		       st.nr_migrations);
+	}
+}
+
+static void schedstat_read(struct device *dev, const char *buf) {
+	(void)dev;
+	(void)buf;
+	schedstat_show();
+}
+
+static int __init schedstat_init(void) {
+	if (!devicefs_add("schedstat", NULL, schedstat_read, NULL))
+		pr_warn("failed to register the schedstat device\n");
+	return 0;
+}
+
+fs_initcall(schedstat_init);
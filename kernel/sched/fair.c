@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#define pr_fmt(fmt) "sched: " fmt
+
+#include "sched.h"
+
+/* Weight of a nice 0 task; vruntime advances at wall-clock speed for it. */
+#define NICE_0_LOAD 1024
+
+/**
+ * A running fair task is not preempted by another fair task before it has
+ * had this much CPU time. It bounds the switch rate when many tasks have
+ * nearly the same vruntime.
+ */
+#define SCHED_MIN_GRANULARITY_NSEC (2 * SCHED_TICK_NSEC)
+
+/**
+ * Nice value to weight. Each step is about 1.25x, so one nice level up or
+ * down moves a task's share of the CPU by roughly 10% against a task at the
+ * old level.
+ */
+static const unsigned long sched_prio_to_weight[MAX_NICE - MIN_NICE + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548,  7620,  6100,  4904,  3906,
+    /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+    /*   0 */ 1024,  820,   655,   526,   423,
+    /*   5 */ 335,   272,   215,   172,   137,
+    /*  10 */ 110,   87,    70,    56,    45,
+    /*  15 */ 36,    29,    23,    18,    15,
+};
+
+void fair_task_init(task_t *p, int nice) {
+	p->sched_class = &fair_sched_class;
+	p->nice = nice;
+	p->se.weight = sched_prio_to_weight[nice - MIN_NICE];
+	p->se.vruntime = 0;
+	p->se.sum_exec_runtime = 0;
+	p->se.prev_sum_exec_runtime = 0;
+}
+
+static inline task_t *__node_to_task(struct rb_node *node) {
+	return node ? rb_entry(node, task_t, se.run_node) : NULL;
+}
+
+/* Move min_vruntime up to the smallest vruntime still in play. */
+static void __update_min_vruntime(struct rq *rq) {
+	task_t *first = __node_to_task(
+	    rb_first_cached(&rq->cfs.tasks_timeline));
+	u64 vruntime = rq->cfs.min_vruntime;
+	bool have = false;
+
+	if (rq->curr->sched_class == &fair_sched_class) {
+		vruntime = rq->curr->se.vruntime;
+		have = true;
+	}
+
+	if (first && (!have || first->se.vruntime < vruntime))
+		vruntime = first->se.vruntime;
+
+	if (vruntime > rq->cfs.min_vruntime)
+		rq->cfs.min_vruntime = vruntime;
+}
+
+static void init_rq_fair(struct rq *rq) {
+	rq->cfs.tasks_timeline = RB_ROOT_CACHED;
+	rq->cfs.min_vruntime = 0;
+	rq->cfs.nr_queued = 0;
+}
+
+/**
+ * A task that slept for a long time would otherwise come back far behind
+ * everyone else and keep the CPU until it caught up. Give it a small head
+ * start over min_vruntime instead, and no more.
+ */
+static void __place_wakeup(struct rq *rq, task_t *p) {
+	u64 floor = 0;
+
+	if (rq->cfs.min_vruntime > SCHED_MIN_GRANULARITY_NSEC)
+		floor = rq->cfs.min_vruntime - SCHED_MIN_GRANULARITY_NSEC;
+
+	if (p->se.vruntime < floor)
+		p->se.vruntime = floor;
+}
+
+static void enqueue_task_fair(struct rq *rq, task_t *p, int flags) {
+	struct rb_node **link = &rq->cfs.tasks_timeline.rb_root.rb_node;
+	struct rb_node *parent = NULL;
+	bool leftmost = true;
+
+	/**
+	 * A new task starts level with the least-served one already here, so
+	 * it neither jumps the whole queue nor waits for everyone to catch up
+	 * from zero.
+	 */
+	if (flags & ENQUEUE_NEW)
+		p->se.vruntime = rq->cfs.min_vruntime;
+	else if (flags & ENQUEUE_MIGRATED)
+		p->se.vruntime += rq->cfs.min_vruntime;
+	else if (flags & ENQUEUE_WAKEUP)
+		__place_wakeup(rq, p);
+
+	/* Equal keys go to the right, so ties are served in FIFO order. */
+	while (*link) {
+		parent = *link;
+		if (p->se.vruntime < __node_to_task(parent)->se.vruntime) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+
+	rb_link_node(&p->se.run_node, parent, link);
+	rb_insert_color_cached(&p->se.run_node, &rq->cfs.tasks_timeline,
+			       leftmost);
+	rq->cfs.nr_queued++;
+}
+
+/* Take the task that has had the least CPU time, weighted by nice. */
+static task_t *pick_next_task_fair(struct rq *rq) {
+	task_t *p =
+	    __node_to_task(rb_first_cached(&rq->cfs.tasks_timeline));
+
+	if (!p)
+		return NULL;
+
+	rb_erase_cached(&p->se.run_node, &rq->cfs.tasks_timeline);
+	rq->cfs.nr_queued--;
+	p->se.prev_sum_exec_runtime = p->se.sum_exec_runtime;
+
+	return p;
+}
+
+/**
+ * Charge the tick to the running task, then let it go once it has run for
+ * the minimum granularity and someone else is further behind.
+ */
+static bool task_tick_fair(struct rq *rq, task_t *p) {
+	struct sched_entity *se = &p->se;
+	task_t *first;
+
+	se->sum_exec_runtime += SCHED_TICK_NSEC;
+	se->vruntime += SCHED_TICK_NSEC * NICE_0_LOAD / se->weight;
+	__update_min_vruntime(rq);
+
+	if (se->sum_exec_runtime - se->prev_sum_exec_runtime <
+	    SCHED_MIN_GRANULARITY_NSEC)
+		return false;
+
+	first = __node_to_task(rb_first_cached(&rq->cfs.tasks_timeline));
+	return first && first->se.vruntime < se->vruntime;
+}
+
+static bool has_ready_fair(struct rq *rq) { return rq->cfs.nr_queued != 0; }
+
+/**
+ * Move the task furthest from its turn, the rightmost in the tree.
+ *
+ * Each CPU's min_vruntime moves on its own, so a migrating task carries its
+ * lead over the old queue's minimum instead of the raw value. The new queue
+ * adds its own minimum back in enqueue_task_fair().
+ */
+static task_t *detach_task_fair(struct rq *rq) {
+	struct rb_node *node;
+
+	for (node = rb_last(&rq->cfs.tasks_timeline.rb_root); node;
+	     node = rb_prev(node)) {
+		task_t *p = __node_to_task(node);
+
+		if (!task_can_migrate(p))
+			continue;
+
+		rb_erase_cached(&p->se.run_node, &rq->cfs.tasks_timeline);
+		rq->cfs.nr_queued--;
+
+		if (p->se.vruntime > rq->cfs.min_vruntime)
+			p->se.vruntime -= rq->cfs.min_vruntime;
+		else
+			p->se.vruntime = 0;
+		return p;
+	}
+
+	return NULL;
+}
+
+const struct sched_class fair_sched_class = {
+    .next = NULL,
+    .init_rq = init_rq_fair,
+    .enqueue_task = enqueue_task_fair,
+    .pick_next_task = pick_next_task_fair,
+    .task_tick = task_tick_fair,
+    .has_ready = has_ready_fair,
+    .detach_task = detach_task_fair,
+};
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#define pr_fmt(fmt) "sched: " fmt
+
+#include "sched.h"
+
+/* Timer ticks a task of priority @prio runs before round-robin kicks in. */
+static inline unsigned int task_timeslice(int prio) {
+	return (MAX_PRIO - prio) / 8 + 1;
+}
+
+void rr_task_init(task_t *p, int prio) {
+	p->sched_class = &rr_sched_class;
+	p->prio = prio;
+	p->time_slice = task_timeslice(prio);
+}
+
+static void init_rq_rr(struct rq *rq) {
+	rq->rr.bitmap = 0;
+	for (int prio = 0; prio < MAX_PRIO; prio++)
+		INIT_LIST_HEAD(&rq->rr.queue[prio]);
+}
+
+static void enqueue_task_rr(struct rq *rq, task_t *p, int flags) {
+	(void)flags;
+
+	list_add_tail(&p->run_list, &rq->rr.queue[p->prio]);
+	rq->rr.bitmap |= 1UL << p->prio;
+}
+
+/* Pop the most urgent ready task, or NULL if there is none. */
+static task_t *pick_next_task_rr(struct rq *rq) {
+	struct list_head *queue;
+	task_t *p;
+	int prio;
+
+	if (!rq->rr.bitmap)
+		return NULL;
+
+	prio = __builtin_ctzl(rq->rr.bitmap);
+	queue = &rq->rr.queue[prio];
+	p = list_first_entry(queue, task_t, run_list);
+
+	list_del_init(&p->run_list);
+	if (list_empty(queue))
+		rq->rr.bitmap &= ~(1UL << prio);
+
+	return p;
+}
+
+/**
+ * The running task keeps the CPU until its time slice is used up or a more
+ * urgent task becomes ready. It then goes to the back of its priority's
+ * queue with a fresh slice.
+ */
+static bool task_tick_rr(struct rq *rq, task_t *p) {
+	bool preempt =
+	    rq->rr.bitmap && __builtin_ctzl(rq->rr.bitmap) < p->prio;
+
+	if (--p->time_slice && !preempt)
+		return false;
+
+	p->time_slice = task_timeslice(p->prio);
+	return true;
+}
+
+static bool has_ready_rr(struct rq *rq) { return rq->rr.bitmap != 0; }
+
+/**
+ * The least urgent priority goes first, and within it the task that has
+ * waited the shortest: it is at the tail, and is the least likely to still
+ * have anything in this CPU's caches.
+ */
+static task_t *detach_task_rr(struct rq *rq) {
+	for (u64 bits = rq->rr.bitmap; bits;) {
+		int prio = 63 - __builtin_clzl(bits);
+		struct list_head *queue = &rq->rr.queue[prio];
+		struct list_head *pos;
+
+		list_for_each_prev(pos, queue) {
+			task_t *p = list_entry(pos, task_t, run_list);
+
+			if (!task_can_migrate(p))
+				continue;
+
+			list_del_init(&p->run_list);
+			if (list_empty(queue))
+				rq->rr.bitmap &= ~(1UL << prio);
+			return p;
+		}
+
+		bits &= ~(1UL << prio);
+	}
+
+	return NULL;
+}
+
+const struct sched_class rr_sched_class = {
+    .next = &fair_sched_class,
+    .init_rq = init_rq_rr,
+    .enqueue_task = enqueue_task_rr,
+    .pick_next_task = pick_next_task_rr,
+    .task_tick = task_tick_rr,
+    .has_ready = has_ready_rr,
+    .detach_task = detach_task_rr,
+};
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _KERNEL_SCHED_SCHED_H
+#define _KERNEL_SCHED_SCHED_H
+
+#include <asm/cache.h>
+#include <lib/rbtree.h>
+#include <seren/config.h>
+#include <seren/sched/sched.h>
+#include <seren/spinlock.h>
+
+/* schedule() runs once per timer tick, 100 times a second. */
+#define SCHED_TICK_NSEC 10000000ULL
+
+/* enqueue_task() flags */
+#define ENQUEUE_NEW	 0x1 /* The task has never run */
+#define ENQUEUE_MIGRATED 0x2 /* The task comes from another CPU */
+#define ENQUEUE_WAKEUP	 0x4 /* The task was blocked */
+
+/**
+ * Every SCHED_BALANCE_INTERVAL ticks a CPU compares its load average with
+ * the busiest CPU and pulls a task over if it trails by more than
+ * SCHED_BALANCE_THRESHOLD.
+ */
+#define SCHED_BALANCE_INTERVAL	10
+#define SCHED_BALANCE_THRESHOLD SCHED_LOAD_SCALE
+
+/* The load average moves 1/2^SCHED_LOAD_AVG_SHIFT of the way each tick. */
+#define SCHED_LOAD_AVG_SHIFT 5
+
+/**
+ * struct prio_array - Ready round-robin tasks sorted by priority
+ * @bitmap: Bit N is set when @queue[N] is not empty
+ * @queue: FIFO of ready tasks for each priority
+ *
+ * Finding the most urgent task is a bit scan of @bitmap plus a list pop,
+ * however many tasks exist.
+ */
+struct prio_array {
+	u64 bitmap;
+	struct list_head queue[MAX_PRIO];
+};
+
+/**
+ * struct cfs_rq - Ready fair tasks sorted by virtual runtime
+ * @tasks_timeline: The tasks, leftmost is the one that has run least
+ * @min_vruntime: Never decreases; new tasks start from here
+ * @nr_queued: Number of tasks in @tasks_timeline
+ */
+struct cfs_rq {
+	struct rb_root_cached tasks_timeline;
+	u64 min_vruntime;
+	unsigned long nr_queued;
+};
+
+/**
+ * struct rq - Per-CPU run queue
+ * @lock: Protects the queue, taken from the timer interrupt
+ * @cpu: The CPU this queue belongs to
+ * @rr: Ready round-robin tasks
+ * @cfs: Ready fair tasks
+ * @curr: Task running on this CPU right now; never on @rr or @cfs
+ * @prev: Task switched away from, until finish_task_switch()
+ * @yield: The next schedule() comes from schedule_yield(), not the timer
+ * @idle: Task to run when no class has anything ready
+ * @nr_running: Number of runnable tasks on this CPU, @curr included
+ * @load_avg: Moving average of @nr_running, scaled by SCHED_LOAD_SCALE
+ * @nr_ticks: Timer ticks seen, paces the rebalancing
+ * @nr_switches: Context switches done by this CPU
+ * @nr_steals: See struct sched_stats
+ * @nr_steal_fails: See struct sched_stats
+ * @nr_migrations: See struct sched_stats
+ *
+ * Other CPUs read @nr_running and @load_avg without the lock to choose
+ * where to steal from.
+ */
+struct rq {
+	spinlock_t lock;
+	unsigned int cpu;
+	struct prio_array rr;
+	struct cfs_rq cfs;
+	task_t *curr;
+	task_t *prev;
+	bool yield;
+	task_t *idle;
+	unsigned long nr_running;
+	unsigned long load_avg;
+	unsigned long nr_ticks;
+	unsigned long nr_switches;
+	unsigned long nr_steals;
+	unsigned long nr_steal_fails;
+	unsigned long nr_migrations;
+} ____cacheline_aligned;
+
+extern struct rq runqueues[NR_CPUS];
+
+/**
+ * struct sched_class - A scheduling policy
+ * @next: The class below this one; its tasks only run when ours can't
+ * @init_rq: Set up the class's part of a run queue
+ * @enqueue_task: Make a task ready to be picked
+ * @pick_next_task: Take the task that should run next off the queue
+ * @task_tick: Account a tick to the running task; true if it should yield
+ * @has_ready: Whether any task of this class is waiting on @rq
+ * @detach_task: Take the task best moved to another CPU off the queue, or
+ *               return NULL. That is the least urgent one for which
+ *               task_can_migrate() holds; the order of the others must not
+ *               change. It will be queued elsewhere with ENQUEUE_MIGRATED.
+ *
+ * All of these are called with @rq->lock held.
+ */
+struct sched_class {
+	const struct sched_class *next;
+
+	void (*init_rq)(struct rq *rq);
+	void (*enqueue_task)(struct rq *rq, task_t *p, int flags);
+	task_t *(*pick_next_task)(struct rq *rq);
+	bool (*task_tick)(struct rq *rq, task_t *p);
+	bool (*has_ready)(struct rq *rq);
+	task_t *(*detach_task)(struct rq *rq);
+};
+
+extern const struct sched_class rr_sched_class;
+extern const struct sched_class fair_sched_class;
+
+#define sched_class_highest (&rr_sched_class)
+
+/**
+ * task_can_migrate - Whether a queued task may move to another CPU
+ *
+ * Not if it is dead, which schedule() cleans up, or if it has been switched
+ * out but its CPU is still running on its stack.
+ */
+static inline bool task_can_migrate(task_t *p) {
+	return p->state != TASK_STATE_DEAD &&
+	       !__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * sched_steal_task - Pull a ready task over from the busiest CPU
+ * @rq: The calling CPU's queue, locked, with nothing ready on it
+ *
+ * Returns true if a task was queued on @rq.
+ */
+bool sched_steal_task(struct rq *rq);
+
+/**
+ * sched_balance_tick - Update the load average and rebalance now and then
+ * @rq: The calling CPU's queue, locked
+ */
+void sched_balance_tick(struct rq *rq);
+
+/**
+ * rr_task_init - Put a new task in the round-robin class
+ * @prio: Between 0 (most urgent) and MAX_PRIO - 1
+ */
+void rr_task_init(task_t *p, int prio);
+
+/**
+ * fair_task_init - Put a new task in the fair class
+ * @nice: Between MIN_NICE and MAX_NICE
+ */
+void fair_task_init(task_t *p, int nice);
+
+#endif // _KERNEL_SCHED_SCHED_H
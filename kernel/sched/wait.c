@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#include <seren/wait.h>
+
+void init_waitqueue_head(wait_queue_head_t *wq) {
+	spin_init(&wq->lock);
+	INIT_LIST_HEAD(&wq->head);
+}
+
+void init_wait_entry(struct wait_queue_entry *wait) {
+	wait->task = current_task();
+	INIT_LIST_HEAD(&wait->entry);
+}
+
+void prepare_to_wait(wait_queue_head_t *wq, struct wait_queue_entry *wait) {
+	u64 flags;
+
+	/**
+	 * Queue first, then block: a wake_up() that comes in after the
+	 * caller's condition check finds the task and makes it runnable
+	 * again before it gets to yield.
+	 */
+	spin_lock_irqsave(&wq->lock, flags);
+	if (list_empty(&wait->entry))
+		list_add_tail(&wait->entry, &wq->head);
+	set_current_state(TASK_STATE_BLOCKED);
+	spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void finish_wait(wait_queue_head_t *wq, struct wait_queue_entry *wait) {
+	u64 flags;
+
+	set_current_state(TASK_STATE_RUNNING);
+
+	/* wake_up() already unlinks the entries it wakes. */
+	if (!list_empty(&wait->entry)) {
+		spin_lock_irqsave(&wq->lock, flags);
+		list_del_init(&wait->entry);
+		spin_unlock_irqrestore(&wq->lock, flags);
+	}
+}
+
+int wake_up(wait_queue_head_t *wq) {
+	struct list_head *pos, *n;
+	int woken = 0;
+	u64 flags;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	list_for_each_safe(pos, n, &wq->head) {
+		struct wait_queue_entry *wait =
+		    list_entry(pos, struct wait_queue_entry, entry);
+
+		list_del_init(&wait->entry);
+		woken += wake_up_process(wait->task);
+	}
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return woken;
+}
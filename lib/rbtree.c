@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#include <lib/rbtree.h>
+
+/**
+ * The usual red-black rules hold: the root and all NULL leaves are black,
+ * a red node has no red children, and every path down to a leaf passes the
+ * same number of black nodes. That keeps the height under 2 * log2(n + 1).
+ */
+
+static inline bool __rb_is_black(const struct rb_node *node) {
+	return !node || node->rb_color == RB_BLACK;
+}
+
+/* Make @parent (or the root, if @parent is NULL) point at @new, not @old. */
+static inline void __rb_change_child(struct rb_node *old, struct rb_node *new,
+				     struct rb_node *parent,
+				     struct rb_root *root) {
+	if (!parent)
+		root->rb_node = new;
+	else if (parent->rb_left == old)
+		parent->rb_left = new;
+	else
+		parent->rb_right = new;
+}
+
+static void __rb_rotate_left(struct rb_node *node, struct rb_root *root) {
+	struct rb_node *right = node->rb_right;
+
+	node->rb_right = right->rb_left;
+	if (right->rb_left)
+		right->rb_left->rb_parent = node;
+
+	right->rb_parent = node->rb_parent;
+	__rb_change_child(node, right, node->rb_parent, root);
+
+	right->rb_left = node;
+	node->rb_parent = right;
+}
+
+static void __rb_rotate_right(struct rb_node *node, struct rb_root *root) {
+	struct rb_node *left = node->rb_left;
+
+	node->rb_left = left->rb_right;
+	if (left->rb_right)
+		left->rb_right->rb_parent = node;
+
+	left->rb_parent = node->rb_parent;
+	__rb_change_child(node, left, node->rb_parent, root);
+
+	left->rb_right = node;
+	node->rb_parent = left;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+	struct rb_node *parent, *gparent, *uncle;
+
+	while ((parent = node->rb_parent) && parent->rb_color == RB_RED) {
+		/* A red parent is never the root, so there is a grandparent. */
+		gparent = parent->rb_parent;
+
+		if (parent == gparent->rb_left) {
+			uncle = gparent->rb_right;
+			if (!__rb_is_black(uncle)) {
+				/* Push the red up and carry on from there. */
+				parent->rb_color = RB_BLACK;
+				uncle->rb_color = RB_BLACK;
+				gparent->rb_color = RB_RED;
+				node = gparent;
+				continue;
+			}
+
+			if (node == parent->rb_right) {
+				__rb_rotate_left(parent, root);
+				node = parent;
+				parent = node->rb_parent;
+			}
+
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			__rb_rotate_right(gparent, root);
+		} else {
+			uncle = gparent->rb_left;
+			if (!__rb_is_black(uncle)) {
+				parent->rb_color = RB_BLACK;
+				uncle->rb_color = RB_BLACK;
+				gparent->rb_color = RB_RED;
+				node = gparent;
+				continue;
+			}
+
+			if (node == parent->rb_left) {
+				__rb_rotate_right(parent, root);
+				node = parent;
+				parent = node->rb_parent;
+			}
+
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			__rb_rotate_left(gparent, root);
+		}
+	}
+
+	root->rb_node->rb_color = RB_BLACK;
+}
+
+/*
+ * Restore the black height after a black node was taken out above @node.
+ * @node may be NULL, which is why its parent is passed separately.
+ */
+static void __rb_erase_color(struct rb_node *node, struct rb_node *parent,
+			     struct rb_root *root) {
+	struct rb_node *sibling;
+
+	while (node != root->rb_node && __rb_is_black(node)) {
+		if (node == parent->rb_left) {
+			sibling = parent->rb_right;
+			if (sibling->rb_color == RB_RED) {
+				sibling->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				__rb_rotate_left(parent, root);
+				sibling = parent->rb_right;
+			}
+
+			if (__rb_is_black(sibling->rb_left) &&
+			    __rb_is_black(sibling->rb_right)) {
+				sibling->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+
+			if (__rb_is_black(sibling->rb_right)) {
+				sibling->rb_left->rb_color = RB_BLACK;
+				sibling->rb_color = RB_RED;
+				__rb_rotate_right(sibling, root);
+				sibling = parent->rb_right;
+			}
+
+			sibling->rb_color = parent->rb_color;
+			parent->rb_color = RB_BLACK;
+			sibling->rb_right->rb_color = RB_BLACK;
+			__rb_rotate_left(parent, root);
+		} else {
+			sibling = parent->rb_left;
+			if (sibling->rb_color == RB_RED) {
+				sibling->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				__rb_rotate_right(parent, root);
+				sibling = parent->rb_left;
+			}
+
+			if (__rb_is_black(sibling->rb_left) &&
+			    __rb_is_black(sibling->rb_right)) {
+				sibling->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+
+			if (__rb_is_black(sibling->rb_left)) {
+				sibling->rb_right->rb_color = RB_BLACK;
+				sibling->rb_color = RB_RED;
+				__rb_rotate_left(sibling, root);
+				sibling = parent->rb_left;
+			}
+
+			sibling->rb_color = parent->rb_color;
+			parent->rb_color = RB_BLACK;
+			sibling->rb_left->rb_color = RB_BLACK;
+			__rb_rotate_right(parent, root);
+		}
+
+		node = root->rb_node;
+		break;
+	}
+
+	if (node)
+		node->rb_color = RB_BLACK;
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+	struct rb_node *child, *parent;
+	int color = node->rb_color;
+
+	if (!node->rb_left || !node->rb_right) {
+		/* At most one child: splice it into our place. */
+		child = node->rb_left ? node->rb_left : node->rb_right;
+		parent = node->rb_parent;
+
+		__rb_change_child(node, child, parent, root);
+		if (child)
+			child->rb_parent = parent;
+	} else {
+		/**
+		 * Two children: our successor, the leftmost node on the right,
+		 * has no left child. Unhook it and put it where we were.
+		 */
+		struct rb_node *succ = node->rb_right;
+
+		while (succ->rb_left)
+			succ = succ->rb_left;
+
+		color = succ->rb_color;
+		child = succ->rb_right;
+
+		if (succ->rb_parent == node) {
+			parent = succ;
+		} else {
+			parent = succ->rb_parent;
+			parent->rb_left = child;
+			if (child)
+				child->rb_parent = parent;
+
+			succ->rb_right = node->rb_right;
+			succ->rb_right->rb_parent = succ;
+		}
+
+		__rb_change_child(node, succ, node->rb_parent, root);
+		succ->rb_parent = node->rb_parent;
+		succ->rb_left = node->rb_left;
+		succ->rb_left->rb_parent = succ;
+		succ->rb_color = node->rb_color;
+	}
+
+	if (color == RB_BLACK)
+		__rb_erase_color(child, parent, root);
+}
+
+struct rb_node *rb_first(const struct rb_root *root) {
+	struct rb_node *node = root->rb_node;
+
+	if (!node)
+		return NULL;
+	while (node->rb_left)
+		node = node->rb_left;
+	return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+	struct rb_node *node = root->rb_node;
+
+	if (!node)
+		return NULL;
+	while (node->rb_right)
+		node = node->rb_right;
+	return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+	struct rb_node *parent;
+
+	if (node->rb_right) {
+		node = node->rb_right;
+		while (node->rb_left)
+			node = node->rb_left;
+		return (struct rb_node *)node;
+	}
+
+	while ((parent = node->rb_parent) && node == parent->rb_right)
+		node = parent;
+
+	return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node) {
+	struct rb_node *parent;
+
+	if (node->rb_left) {
+		node = node->rb_left;
+		while (node->rb_right)
+			node = node->rb_right;
+		return (struct rb_node *)node;
+	}
+
+	while ((parent = node->rb_parent) && node == parent->rb_left)
+		node = parent;
+
+	return parent;
+}
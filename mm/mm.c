@@ -8,43 +8,72 @@
 #include <seren/panic.h>
 #include <seren/printk.h>
 
-void *kmalloc(size_t size) {
-	if (unlikely(size == 0)) {
+/**
+ * Allocations too big for the kmalloc caches get their own pages. The first
+ * page is marked PG_large and remembers the order, so kfree() knows how many
+ * to give back and the caller gets the whole block, page-aligned.
+ */
+static void *__kmalloc_large(size_t size) {
+	u32 order = get_order(size);
+	struct page *pg;
+
+	pg = alloc_pages(order);
+	if (unlikely(!pg)) {
 		return NULL;
 	}
 
-	if (size > (1UL << KMALLOC_MAX_SHIFT)) {
-		pr_warn(
-		    "kmalloc: large allocation (%zu bytes) not yet supported\n",
-		    size);
-		return NULL;
+	pg->flags |= PG_large;
+	pg->order = order;
+
+	return page_to_virt(pg);
+}
+
+static int __kfree_large(struct page *pg, void *ptr) {
+	if (!(pg->flags & PG_large) || ptr != page_to_virt(pg)) {
+		return 0;
 	}
 
-	struct kmem_cache *cache = slab_get_kmalloc_cache(size);
-	if (unlikely(!cache)) {
+	pg->flags &= ~PG_large;
+	free_pages(pg, pg->order);
+	return 1;
+}
+
+void *__kmalloc(size_t size) {
+	if (unlikely(size == 0)) {
 		return NULL;
 	}
 
-	return kmem_cache_alloc(cache);
+	if (size > KMALLOC_MAX_CACHE_SIZE) {
+		if (unlikely(size > KMALLOC_MAX_SIZE)) {
+			pr_warn("kmalloc: allocation of %lu bytes exceeds "
+				"KMALLOC_MAX_SIZE\n",
+				(unsigned long)size);
+			return NULL;
+		}
+		return __kmalloc_large(size);
+	}
+
+	return kmalloc_class_alloc(kmalloc_size_index(size), size);
 }
 
 void kfree(void *ptr) {
-	struct slab *sl;
 	struct page *pg;
 
 	if (unlikely(!ptr)) {
 		return;
 	}
 
-	pg = virt_to_page(ptr);
-	sl = (struct slab *)page_to_virt(pg);
+	pg = virt_to_slab_page(ptr);
+	if (likely(pg && pg->slab_cache)) {
+		kmem_cache_free(pg->slab_cache, ptr);
+		return;
+	}
 
-	if (sl->magic != SLAB_PAGE_MAGIC || !sl->cache) {
+	pg = virt_to_page(ptr);
+	if (!pg || !__kfree_large(pg, ptr)) {
 		panic("kfree: invalid pointer %p or slab metadata corruption",
 		      ptr);
 	}
-
-	kmem_cache_free(sl->cache, ptr);
 }
 
 void *kcalloc(size_t num, size_t size) {
@@ -5,19 +5,139 @@
 
 #define pr_fmt(fmt) "pmm: " fmt
 
+#include <asm/page.h>
+#include <asm/processor.h>
 #include <limine.h>
 #include <seren/config.h>
 #include <seren/init.h>
 #include <seren/mm/pmm.h>
+#include <seren/mm/shrinker.h>
 #include <seren/panic.h>
 #include <seren/printk.h>
+#include <seren/smp.h>
+#include <seren/spinlock.h>
 #include <seren/types.h>
 
 static unsigned long *bitmap;
-static struct page *mem_map;
+static unsigned long *summary;
+
+/**
+ * Sparse memory model: physical memory is cut into 128 MiB sections and only
+ * sections that hold RAM get `struct page`s. A hole in the memory map, like
+ * the PCI hole below 4 GiB, costs one pointer per section instead of one
+ * `struct page` per frame. Sections are far bigger than a MAX_ORDER block, so
+ * a buddy always lives in the same section as its block.
+ */
+#define PFN_SECTION_SHIFT (27 - PAGE_SHIFT)
+#define PAGES_PER_SECTION (1UL << PFN_SECTION_SHIFT)
+#define PAGE_SECTION_MASK (PAGES_PER_SECTION - 1)
+
+/**
+ * struct mem_section - One 128 MiB piece of physical memory
+ * @mem_map: The section's `struct page`s, or NULL if it has no RAM
+ */
+struct mem_section {
+	struct page *mem_map;
+};
+
+static struct mem_section *mem_sections;
+static unsigned long nr_mem_sections;
 
 static unsigned long max_pfn;
-static unsigned long nr_free;
+static unsigned long nr_bitmap_words;
+
+/* Zone boundaries, in PFNs. Both are far above MAX_ORDER alignment, so a
+ * buddy block can never straddle two zones. */
+#define ZONE_DMA_END_PFN   (PFN_DOWN(16UL << 20))
+#define ZONE_DMA32_END_PFN (PFN_DOWN(4UL << 30))
+
+/**
+ * `struct page`s are initialized lazily, a chunk at a time. A chunk is one
+ * MAX_ORDER block, so a buddy never lives in a chunk that hasn't been set up.
+ * Each zone gets PMM_INIT_CHUNK_PAGES worth at boot and grows by the same
+ * amount whenever its free lists run dry.
+ */
+#define DEFERRED_CHUNK_PAGES (1UL << (MAX_ORDER - 1))
+#define PMM_INIT_CHUNK_PAGES (8 * DEFERRED_CHUNK_PAGES)
+
+/**
+ * struct free_area - One buddy free list
+ * @free_list: Head pages of the free blocks of this order
+ * @nr_free: Number of blocks on @free_list
+ */
+struct free_area {
+	struct list_head free_list;
+	unsigned long nr_free;
+};
+
+/**
+ * struct zone - A range of physical memory with its own buddy free lists
+ * @name: Name used in log messages
+ * @start_pfn: First PFN of the zone
+ * @end_pfn: One past the last PFN of the zone
+ * @nr_free: Free pages on this zone's free lists
+ * @init_end_pfn: `struct page`s below this PFN are initialized
+ * @nr_deferred: Free pages at or above @init_end_pfn, not on any list yet
+ * @nr_movable: Allocated pages marked with set_page_movable()
+ * @free_area: The buddy free lists, one per order
+ */
+struct zone {
+	const char *name;
+	u64 start_pfn;
+	u64 end_pfn;
+	unsigned long nr_free;
+	u64 init_end_pfn;
+	unsigned long nr_deferred;
+	unsigned long nr_movable;
+	struct free_area free_area[MAX_ORDER];
+};
+
+static struct zone zones[MAX_NR_ZONES] = {
+    [ZONE_DMA] = {.name = "DMA", .start_pfn = 0, .end_pfn = ZONE_DMA_END_PFN},
+    [ZONE_DMA32] = {.name = "DMA32",
+		    .start_pfn = ZONE_DMA_END_PFN,
+		    .end_pfn = ZONE_DMA32_END_PFN},
+    [ZONE_NORMAL] = {.name = "Normal",
+		     .start_pfn = ZONE_DMA32_END_PFN,
+		     .end_pfn = ~0ULL},
+};
+
+/**
+ * Protects the zones' free lists and counters, and the bitmap. The per-CPU
+ * page lists below only take it when they refill or drain a batch.
+ */
+static spinlock_t pmm_lock = SPIN_LOCK_UNLOCKED;
+
+/**
+ * struct per_cpu_pages - A CPU-local cache of free order-0 pages
+ * @list: The cached pages, most recently freed (cache-hot) first
+ * @count: Number of pages on @list
+ * @stats: Hit/miss counters, see struct pcp_stats
+ *
+ * Only touched by its own CPU with interrupts disabled, so it needs no lock.
+ * Pages on the list are still accounted as allocated by the buddy allocator.
+ */
+struct per_cpu_pages {
+	struct list_head list;
+	unsigned int count;
+	struct pcp_stats stats;
+};
+
+static struct per_cpu_pages pcp_lists[NR_CPUS];
+
+static unsigned int pcp_low = PCP_DEFAULT_LOW;
+static unsigned int pcp_high = PCP_DEFAULT_HIGH;
+
+static unsigned long wmark_low;
+static unsigned long wmark_high;
+
+/**
+ * Free page count below which the next reclaim runs. It is the low
+ * watermark, unless the last reclaim couldn't get back above it, in which
+ * case another PMM_RECLAIM_RETRY_PAGES have to be allocated first.
+ */
+#define PMM_RECLAIM_RETRY_PAGES 64
+static unsigned long reclaim_below;
 
 extern volatile struct limine_hhdm_request hhdm_request;
 extern volatile struct limine_memmap_request memmap_request;
@@ -28,16 +148,33 @@ extern char _kernel_end[];
  * These are the low-level helpers for manipulating the page bitmap.
  * `pfn >> 6` finds the u64 in the array and `pfn & 63` finds the bit within
  * that u64.
+ *
+ * The bitmap records which frames are in use (set) or free (clear). The buddy
+ * free lists below decide *what* to hand out, the bitmap is what we check
+ * frees against and what we search when we need a specific range.
+ *
+ * On top of it sits the summary: one bit per bitmap word, set when that word
+ * has at least one free frame. Searches use it to jump over fully used
+ * stretches 4096 frames at a time instead of testing every frame.
  */
+static inline void __update_summary(u64 word) {
+	if (bitmap[word] != ~0UL)
+		summary[word >> 6] |= (1UL << (word & 63));
+	else
+		summary[word >> 6] &= ~(1UL << (word & 63));
+}
+
 static inline void __set_bit(u64 pfn) {
 	if (pfn >= max_pfn)
 		return;
 	bitmap[pfn >> 6] |= (1UL << (pfn & 63));
+	__update_summary(pfn >> 6);
 }
 static inline void __clear_bit(u64 pfn) {
 	if (pfn >= max_pfn) /* Out of bounds is considered "used" */
 		return;
 	bitmap[pfn >> 6] &= ~(1UL << (pfn & 63));
+	__update_summary(pfn >> 6);
 }
 static inline int __test_bit(u64 pfn) {
 	if (pfn >= max_pfn)
@@ -46,53 +183,651 @@ static inline int __test_bit(u64 pfn) {
 }
 
 /**
- * __find_free_pages - A irst-fit search for a contiguous block of pages.
+ * __range_mask - Bits of the bitmap word holding @pfn covered by a range
+ * that starts at @pfn and is @count frames long.
+ * @nr: Set to the number of frames the mask covers.
+ */
+static inline unsigned long __range_mask(u64 pfn, u64 count, u64 *nr) {
+	unsigned long bit = pfn & 63;
+	unsigned long mask = ~0UL << bit;
+
+	if (bit + count < 64) {
+		mask &= ~(~0UL << (bit + count));
+		*nr = count;
+	} else {
+		*nr = 64 - bit;
+	}
+	return mask;
+}
+
+/**
+ * The range helpers work a whole word at a time, so marking a 2^order block
+ * costs 2^order / 64 stores instead of one per frame.
+ */
+static void __set_bit_range(u64 pfn, u64 count) {
+	while (count) {
+		u64 n;
+		unsigned long mask = __range_mask(pfn, count, &n);
+
+		bitmap[pfn >> 6] |= mask;
+		__update_summary(pfn >> 6);
+		pfn += n;
+		count -= n;
+	}
+}
+
+static void __clear_bit_range(u64 pfn, u64 count) {
+	while (count) {
+		u64 n;
+		unsigned long mask = __range_mask(pfn, count, &n);
+
+		bitmap[pfn >> 6] &= ~mask;
+		__update_summary(pfn >> 6);
+		pfn += n;
+		count -= n;
+	}
+}
+
+/* Returns 1 if every frame in the range is marked as in use. */
+static int __test_bit_range(u64 pfn, u64 count) {
+	while (count) {
+		u64 n;
+		unsigned long mask = __range_mask(pfn, count, &n);
+
+		if ((bitmap[pfn >> 6] & mask) != mask)
+			return 0;
+		pfn += n;
+		count -= n;
+	}
+	return 1;
+}
+
+/**
+ * __next_free_word - Index of the first bitmap word at or after @word that
+ * has a free frame, or `nr_bitmap_words` if there is none.
  */
-static s64 __find_free_pages(size_t count) {
-	u64 consecutive = 0;
-	u64 start_pfn = 0;
+static u64 __next_free_word(u64 word) {
+	u64 nr_summary_words = (nr_bitmap_words + 63) >> 6;
+	u64 idx = word >> 6;
+	unsigned long bits;
+
+	if (word >= nr_bitmap_words)
+		return nr_bitmap_words;
+
+	bits = summary[idx] & (~0UL << (word & 63));
+	while (!bits) {
+		if (++idx >= nr_summary_words)
+			return nr_bitmap_words;
+		bits = summary[idx];
+	}
+
+	return (idx << 6) + __builtin_ctzl(bits);
+}
 
-	if (!count || !bitmap)
+/**
+ * __next_free_run - Find the next run of free frames.
+ * @from: PFN to start looking at
+ * @start: Set to the first free PFN at or after @from
+ * @end: Set to the first used PFN after @start
+ *
+ * Returns 0 if a run was found and -1 once we run past `max_pfn`. Used words
+ * are skipped through the summary, free words are swallowed whole, and the
+ * edges of a run come from a single count-trailing-zeros on the word.
+ */
+static int __next_free_run(u64 from, u64 *start, u64 *end) {
+	u64 word = from >> 6;
+	unsigned long bits;
+
+	if (from >= max_pfn)
 		return -1;
 
-	for (u64 pfn = 0; pfn < max_pfn; pfn++) {
-		if (!__test_bit(pfn)) {
-			if (consecutive == 0)
-				start_pfn = pfn;
-			consecutive++;
-			if (consecutive == count)
-				return start_pfn;
-		} else {
-			consecutive = 0;
+	bits = ~bitmap[word] & (~0UL << (from & 63));
+	while (!bits) {
+		word = __next_free_word(word + 1);
+		if (word >= nr_bitmap_words)
+			return -1;
+		bits = ~bitmap[word];
+	}
+	*start = (word << 6) + __builtin_ctzl(bits);
+
+	/* Bits past max_pfn are always set, so this can't run off the end. */
+	bits = bitmap[word] & (~0UL << (*start & 63));
+	while (!bits) {
+		if (++word >= nr_bitmap_words) {
+			*end = max_pfn;
+			return 0;
 		}
+		bits = bitmap[word];
+	}
+	*end = (word << 6) + __builtin_ctzl(bits);
+	if (*end > max_pfn)
+		*end = max_pfn;
+
+	return 0;
+}
+
+/**
+ * __find_free_range - Find @count free frames starting on a multiple of
+ * @align (which must be a power of two).
+ *
+ * Returns the first PFN of the range or -1 if no run is big enough.
+ */
+static s64 __find_free_range(u64 count, u64 align) {
+	u64 pfn = 0, start, end;
+
+	while (__next_free_run(pfn, &start, &end) == 0) {
+		u64 aligned = (start + align - 1) & ~(align - 1);
+
+		if (aligned < end && end - aligned >= count)
+			return aligned;
+		pfn = end;
 	}
 
 	return -1;
 }
 
-static void __mark_pages_inuse(u64 start_pfn, size_t count) {
-	for (size_t i = 0; i < count; i++) {
-		__set_bit(start_pfn + i);
-		nr_free--;
+static inline struct page *__pfn_to_page(u64 pfn) {
+	return &mem_sections[pfn >> PFN_SECTION_SHIFT]
+		    .mem_map[pfn & PAGE_SECTION_MASK];
+}
+
+static inline struct zone *__pfn_to_zone(u64 pfn) {
+	if (pfn < ZONE_DMA_END_PFN)
+		return &zones[ZONE_DMA];
+	if (pfn < ZONE_DMA32_END_PFN)
+		return &zones[ZONE_DMA32];
+	return &zones[ZONE_NORMAL];
+}
+
+/**
+ * Free page accounting happens here: a zone's `nr_free` is exactly the number
+ * of pages sitting on its free lists.
+ */
+static inline void __add_to_free_area(struct page *page, u32 order) {
+	struct zone *zone = __pfn_to_zone(page->pfn);
+
+	page->flags |= PG_buddy;
+	page->order = order;
+	list_add(&page->list, &zone->free_area[order].free_list);
+	zone->free_area[order].nr_free++;
+	zone->nr_free += 1UL << order;
+}
+
+static inline void __del_from_free_area(struct page *page, u32 order) {
+	struct zone *zone = __pfn_to_zone(page->pfn);
+
+	list_del(&page->list);
+	page->flags &= ~PG_buddy;
+	page->order = 0;
+	zone->free_area[order].nr_free--;
+	zone->nr_free -= 1UL << order;
+}
+
+static inline unsigned long __nr_buddy_free(void) {
+	unsigned long total = 0;
+
+	for (int i = 0; i < MAX_NR_ZONES; i++)
+		total += zones[i].nr_free;
+	return total;
+}
+
+/**
+ * __buddy_alloc - Take a 2^order block off the free lists.
+ *
+ * Finds the smallest order that has a free block, and if it is bigger than
+ * what was asked for, splits it in halves. The upper half goes back on the
+ * free list one order down each time until we are left with the right size.
+ */
+static struct page *__buddy_alloc(struct zone *zone, u32 order) {
+	for (u32 cur = order; cur < MAX_ORDER; cur++) {
+		struct free_area *area = &zone->free_area[cur];
+		struct page *page;
+
+		if (list_empty(&area->free_list))
+			continue;
+
+		page = list_first_entry(&area->free_list, struct page, list);
+		__del_from_free_area(page, cur);
+
+		while (cur > order) {
+			cur--;
+			__add_to_free_area(__pfn_to_page(page->pfn + (1UL << cur)),
+					   cur);
+		}
+
+		return page;
+	}
+
+	return NULL;
+}
+
+/**
+ * __buddy_free - Put a 2^order block back, merging with free buddies.
+ *
+ * The buddy of a block is the block of the same order whose PFN differs only
+ * in bit `order`. As long as it is also free (it heads a free block of the
+ * same order) the two are merged and we try again one order up.
+ */
+static void __buddy_free(u64 pfn, u32 order) {
+	while (order < MAX_ORDER - 1) {
+		u64 buddy_pfn = pfn ^ (1UL << order);
+		struct page *buddy;
+
+		if (buddy_pfn >= max_pfn)
+			break;
+
+		buddy = __pfn_to_page(buddy_pfn);
+		if (!(buddy->flags & PG_buddy) || buddy->order != order)
+			break;
+
+		__del_from_free_area(buddy, order);
+		pfn &= ~(1UL << order);
+		order++;
+	}
+
+	__add_to_free_area(__pfn_to_page(pfn), order);
+}
+
+/**
+ * __add_free_range - Put the free frames [@pfn, @end) on the free lists as
+ * the largest naturally aligned blocks that fit. No merging is attempted.
+ */
+static void __add_free_range(u64 pfn, u64 end) {
+	while (pfn < end) {
+		u32 order = MAX_ORDER - 1;
+
+		if (pfn && (u32)__builtin_ctzl(pfn) < order)
+			order = __builtin_ctzl(pfn);
+		while (pfn + (1UL << order) > end)
+			order--;
+
+		__add_to_free_area(__pfn_to_page(pfn), order);
+		pfn += 1UL << order;
+	}
+}
+
+/**
+ * __free_block_containing - Find the free block that @pfn is part of.
+ *
+ * A block of order k starts on a 2^k boundary, so we only need to look at
+ * the head candidates @pfn rounded down to each order.
+ */
+static struct page *__free_block_containing(u64 pfn) {
+	for (u32 order = 0; order < MAX_ORDER; order++) {
+		struct page *head = __pfn_to_page(pfn & ~((1UL << order) - 1));
+
+		if ((head->flags & PG_buddy) &&
+		    pfn < head->pfn + (1UL << head->order))
+			return head;
+	}
+
+	return NULL;
+}
+
+/**
+ * __isolate_free_range - Take the free frames [@pfn, @pfn + @count) off the
+ * buddy free lists and mark them as in use.
+ *
+ * Blocks that straddle either edge are pulled off whole and their outside
+ * parts go straight back on the lists. Caller must hold `pmm_lock`.
+ */
+static void __isolate_free_range(u64 pfn, u64 count) {
+	u64 start = pfn, end = pfn + count;
+
+	while (pfn < end) {
+		struct page *head = __free_block_containing(pfn);
+		u64 block_start, block_end;
+
+		if (!head)
+			panic("free frame 0x%lx is not on any free list", pfn);
+
+		block_start = head->pfn;
+		block_end = block_start + (1UL << head->order);
+		__del_from_free_area(head, head->order);
+
+		if (block_start < start)
+			__add_free_range(block_start, start);
+		if (block_end > end)
+			__add_free_range(end, block_end);
+
+		pfn = block_end;
+	}
+
+	__set_bit_range(start, count);
+}
+
+/**
+ * __free_range - Return the in-use frames [@pfn, @pfn + @count) to the
+ * buddy allocator, merging each aligned block with its buddies.
+ *
+ * Caller must hold `pmm_lock`.
+ */
+static void __free_range(u64 pfn, u64 count) {
+	u64 end = pfn + count;
+
+	__clear_bit_range(pfn, count);
+
+	while (pfn < end) {
+		u32 order = MAX_ORDER - 1;
+
+		if (pfn && (u32)__builtin_ctzl(pfn) < order)
+			order = __builtin_ctzl(pfn);
+		while (pfn + (1UL << order) > end)
+			order--;
+
+		__buddy_free(pfn, order);
+		pfn += 1UL << order;
+	}
+}
+
+static inline u64 __zone_end_pfn(struct zone *zone) {
+	return zone->end_pfn < max_pfn ? zone->end_pfn : max_pfn;
+}
+
+/**
+ * Fills out the `struct page`s for [@start, @end) so phys_to_page() works.
+ * Sections without RAM are skipped.
+ */
+static void __init_pages(u64 start, u64 end) {
+	while (start < end) {
+		struct page *map = mem_sections[start >> PFN_SECTION_SHIFT].mem_map;
+		u64 section_end = (start | PAGE_SECTION_MASK) + 1;
+
+		if (section_end > end)
+			section_end = end;
+
+		for (u64 pfn = start; map && pfn < section_end; pfn++) {
+			struct page *page = &map[pfn & PAGE_SECTION_MASK];
+
+			page->pfn = pfn;
+			page->flags = 0;
+			page->order = 0;
+			page->mops = NULL;
+		}
+
+		start = section_end;
+	}
+}
+
+/**
+ * __zone_grow - Initialize @zone's `struct page`s up to at least @pfn.
+ *
+ * The new part is rounded up to whole chunks, and every run of free frames
+ * inside it is carved into the largest naturally aligned blocks that fit.
+ * Blocks are pushed to the head of the lists as we go up in memory, so
+ * allocations prefer high frames and leave low memory for whoever really
+ * needs it. Chunks are MAX_ORDER aligned, so nothing here has a buddy in
+ * memory we set up earlier.
+ *
+ * Returns the number of free pages added. Caller must hold `pmm_lock`.
+ */
+static unsigned long __zone_grow(struct zone *zone, u64 pfn) {
+	u64 zone_end = __zone_end_pfn(zone);
+	u64 from = zone->init_end_pfn, start, end;
+	unsigned long added = 0;
+
+	if (pfn <= from || from >= zone_end)
+		return 0;
+
+	pfn = (pfn + DEFERRED_CHUNK_PAGES - 1) & ~(DEFERRED_CHUNK_PAGES - 1);
+	if (pfn > zone_end)
+		pfn = zone_end;
+
+	__init_pages(from, pfn);
+
+	while (__next_free_run(from, &start, &end) == 0 && start < pfn) {
+		if (end > pfn)
+			end = pfn;
+		__add_free_range(start, end);
+		added += end - start;
+		from = end;
+	}
+
+	zone->init_end_pfn = pfn;
+	if (pfn == zone_end || added > zone->nr_deferred)
+		zone->nr_deferred = 0;
+	else
+		zone->nr_deferred -= added;
+
+	return added;
+}
+
+/* Used before searching the bitmap, which knows nothing about chunks. */
+static void __grow_all_zones(void) {
+	for (int i = 0; i < MAX_NR_ZONES; i++)
+		__zone_grow(&zones[i], __zone_end_pfn(&zones[i]));
+}
+
+/**
+ * __init_free_areas - Set up the buddy free lists.
+ *
+ * Only the first PMM_INIT_CHUNK_PAGES of each zone are handed to the buddy
+ * allocator here, the rest waits for __zone_grow(). @region_free holds each
+ * zone's free page count as worked out from the memory map.
+ */
+static void __init_free_areas(const unsigned long *region_free) {
+	for (int i = 0; i < MAX_NR_ZONES; i++) {
+		struct zone *zone = &zones[i];
+
+		zone->nr_free = 0;
+		for (u32 order = 0; order < MAX_ORDER; order++) {
+			INIT_LIST_HEAD(&zone->free_area[order].free_list);
+			zone->free_area[order].nr_free = 0;
+		}
+
+		zone->init_end_pfn = zone->start_pfn;
+		zone->nr_deferred = region_free[i];
+		__zone_grow(zone, zone->start_pfn + PMM_INIT_CHUNK_PAGES);
 	}
 }
 
-static void __mark_pages_free(u64 start_pfn, size_t count) {
-	for (size_t i = 0; i < count; i++) {
-		if (__test_bit(start_pfn + i)) {
-			__clear_bit(start_pfn + i);
-			nr_free++;
+/**
+ * __rmqueue - Allocate a 2^order block for @gfp and mark it in use.
+ *
+ * Zones are tried from the highest one @gfp allows down to ZONE_DMA, so
+ * ordinary allocations only eat into low memory once high memory is gone.
+ * A zone that still has uninitialized chunks grows before we fall back.
+ * Caller must hold `pmm_lock`.
+ */
+static struct page *__rmqueue(u32 order, gfp_t gfp) {
+	struct page *page = NULL;
+
+	for (int i = gfp_zone(gfp); i >= 0 && !page; i--) {
+		struct zone *zone = &zones[i];
+
+		page = __buddy_alloc(zone, order);
+		while (!page && zone->init_end_pfn < __zone_end_pfn(zone)) {
+			__zone_grow(zone,
+				    zone->init_end_pfn + PMM_INIT_CHUNK_PAGES);
+			page = __buddy_alloc(zone, order);
 		}
 	}
+
+	if (!page)
+		return NULL;
+
+	__set_bit_range(page->pfn, 1UL << order);
+	return page;
+}
+
+/**
+ * __free_one - Return a 2^order block to the buddy allocator.
+ *
+ * Caller must hold `pmm_lock`.
+ */
+static void __free_one(u64 pfn, u32 order) {
+	__clear_bit_range(pfn, 1UL << order);
+	__buddy_free(pfn, order);
+}
+
+/**
+ * __pcp_refill - Pull a batch of pages from the buddy allocator.
+ *
+ * The list is empty when this is called. We bring it up to the low watermark
+ * with a single trip through `pmm_lock`.
+ */
+static void __pcp_refill(struct per_cpu_pages *pcp) {
+	spin_lock(&pmm_lock);
+	while (pcp->count < pcp_low) {
+		struct page *page = __rmqueue(0, GFP_KERNEL);
+
+		if (!page)
+			break;
+		page->flags |= PG_pcp;
+		list_add_tail(&page->list, &pcp->list);
+		pcp->count++;
+	}
+	spin_unlock(&pmm_lock);
+	pcp->stats.refills++;
+}
+
+/**
+ * __pcp_drain - Give pages back to the buddy allocator until only @keep are
+ * left. The coldest pages (at the tail) go first.
+ */
+static void __pcp_drain(struct per_cpu_pages *pcp, unsigned int keep) {
+	if (pcp->count <= keep)
+		return;
+
+	spin_lock(&pmm_lock);
+	while (pcp->count > keep) {
+		struct page *page =
+		    list_last_entry(&pcp->list, struct page, list);
+
+		list_del(&page->list);
+		page->flags &= ~PG_pcp;
+		pcp->count--;
+		__free_one(page->pfn, 0);
+	}
+	spin_unlock(&pmm_lock);
+	pcp->stats.drains++;
+}
+
+/* Sets *@refilled if the list was empty and had to go to the buddy lists. */
+static struct page *__pcp_alloc(bool *refilled) {
+	struct per_cpu_pages *pcp;
+	struct page *page = NULL;
+	unsigned long flags;
+
+	flags = local_irq_save();
+	pcp = &pcp_lists[smp_processor_id()];
+
+	if (likely(pcp->count)) {
+		pcp->stats.hits++;
+	} else {
+		pcp->stats.misses++;
+		__pcp_refill(pcp);
+		*refilled = true;
+	}
+
+	if (likely(pcp->count)) {
+		page = list_first_entry(&pcp->list, struct page, list);
+		list_del(&page->list);
+		page->flags &= ~PG_pcp;
+		pcp->count--;
+	}
+
+	local_irq_restore(flags);
+	return page;
+}
+
+static void __pcp_free(struct page *page) {
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+
+	flags = local_irq_save();
+	pcp = &pcp_lists[smp_processor_id()];
+
+	page->flags |= PG_pcp;
+	list_add(&page->list, &pcp->list);
+	pcp->count++;
+
+	if (unlikely(pcp->count > pcp_high))
+		__pcp_drain(pcp, pcp_low);
+
+	local_irq_restore(flags);
+}
+
+/* Hands the local CPU's cached pages back so higher orders can merge. */
+static void __pcp_drain_local(void) {
+	unsigned long flags;
+
+	flags = local_irq_save();
+	__pcp_drain(&pcp_lists[smp_processor_id()], 0);
+	local_irq_restore(flags);
+}
+
+static void __init_pcp_lists(void) {
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+		INIT_LIST_HEAD(&pcp_lists[cpu].list);
+		pcp_lists[cpu].count = 0;
+	}
+}
+
+/*
+ * Bootloader reclaimable memory gets `struct page`s but is never handed out.
+ * It holds the page tables we run on, the Limine responses (the HHDM offset
+ * is read from one on every page_to_virt()) and the structures the
+ * application processors spin on until smp_init() releases them.
+ */
+static inline int __is_ram_type(u64 type) {
+	return type == LIMINE_MEMMAP_USABLE ||
+	       type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE ||
+	       type == LIMINE_MEMMAP_KERNEL_AND_MODULES;
+}
+
+static inline int __is_free_type(u64 type) {
+	return type == LIMINE_MEMMAP_USABLE;
 }
 
-/* Fills out our `mem_map` array so phys_to_page() works. */
-static void __init_mem_map(u64 hhdm_offset, phys_addr_t mem_map_phys) {
-	mem_map = (struct page *)(hhdm_offset + mem_map_phys);
+/**
+ * __sparse_init - Work out which sections hold RAM.
+ * @map: Where to carve their `struct page`s from, or NULL to only count them
+ *
+ * The kernel image counts as RAM too, so its frames have `struct page`s.
+ * Limine hands us the memory map sorted and without overlaps, so sections
+ * come in order and each is seen once. The last one is cut off at `max_pfn`.
+ *
+ * Returns the number of `struct page`s the present sections need.
+ */
+static u64 __sparse_init(struct limine_memmap_response *memmap,
+			 struct page *map) {
+	u64 nr_pages = 0, next_section = 0;
+
+	for (u64 i = 0; i < memmap->entry_count; i++) {
+		struct limine_memmap_entry *entry = memmap->entries[i];
+		u64 first = entry->base >> PAGE_SHIFT;
+		u64 last = PFN_DOWN(entry->base + entry->length + PAGE_SIZE - 1);
+
+		if (!__is_ram_type(entry->type))
+			continue;
+		if (last > max_pfn)
+			last = max_pfn;
+		if (first >= last)
+			continue;
+
+		u64 section = first >> PFN_SECTION_SHIFT;
+		u64 last_section = (last - 1) >> PFN_SECTION_SHIFT;
+
+		if (section < next_section)
+			section = next_section;
 
-	for (u64 pfn = 0; pfn < max_pfn; pfn++) {
-		mem_map[pfn].pfn = pfn;
+		for (; section <= last_section; section++) {
+			u64 start_pfn = section << PFN_SECTION_SHIFT;
+			u64 nr = max_pfn - start_pfn;
+
+			if (nr > PAGES_PER_SECTION)
+				nr = PAGES_PER_SECTION;
+			if (map)
+				mem_sections[section].mem_map = map + nr_pages;
+			nr_pages += nr;
+		}
+
+		if (last_section + 1 > next_section)
+			next_section = last_section + 1;
 	}
+
+	return nr_pages;
 }
 
 /*
@@ -160,51 +895,66 @@ __get_kernel_end(volatile struct limine_memmap_request *memmap_request) {
 	return (kernel_end + PAGE_SIZE - 1) & PAGE_MASK;
 }
 
+/* Number of frames in [@start, @end) that the memory map says we can use. */
+static u64 __usable_pages(struct limine_memmap_response *memmap, u64 start,
+			  u64 end) {
+	u64 total = 0;
+
+	for (u64 i = 0; i < memmap->entry_count; i++) {
+		struct limine_memmap_entry *entry = memmap->entries[i];
+		u64 first = entry->base >> PAGE_SHIFT;
+		u64 last = (entry->base + entry->length) >> PAGE_SHIFT;
+
+		if (!__is_free_type(entry->type))
+			continue;
+		if (first < start)
+			first = start;
+		if (last > end)
+			last = end;
+		if (first < last)
+			total += last - first;
+	}
+
+	return total;
+}
+
 /**
  * Reserve pages that shouldn't be allocated:
  * - Non-usable memory regions
  * - Kernel image
  * - Allocator metadata (bitmap + mem_map)
+ *
+ * Everything is done per memory map entry with whole-word fills, so this
+ * costs one store per 64 frames. @region_free is filled with each zone's free
+ * page count, worked out from the region lengths alone.
  */
 static void
 __reserve_system_pages(volatile struct limine_memmap_request *memmap_request,
 		       phys_addr_t kernel_end, phys_addr_t metadata_phys,
-		       size_t metadata_size) {
+		       size_t metadata_size, unsigned long *region_free) {
 	struct limine_memmap_response *memmap = memmap_request->response;
 
-	for (u64 pfn = 0; pfn < max_pfn; pfn++)
-		__set_bit(pfn);
-
 	for (u64 i = 0; i < memmap->entry_count; i++) {
 		struct limine_memmap_entry *entry = memmap->entries[i];
+		u64 start_pfn = entry->base >> PAGE_SHIFT;
+		u64 end_pfn = (entry->base + entry->length) >> PAGE_SHIFT;
 
-		if (entry->type == LIMINE_MEMMAP_USABLE ||
-		    entry->type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE) {
-			u64 start_pfn = entry->base >> PAGE_SHIFT;
-			u64 end_pfn =
-			    (entry->base + entry->length) >> PAGE_SHIFT;
-
-			for (u64 pfn = start_pfn;
-			     pfn < end_pfn && pfn < max_pfn; pfn++)
-				__clear_bit(pfn);
-		}
-	}
-
-	nr_free = 0;
-	for (u64 pfn = 0; pfn < max_pfn; pfn++) {
-		if (!__test_bit(pfn))
-			nr_free++;
+		if (!__is_free_type(entry->type))
+			continue;
+		if (end_pfn > max_pfn)
+			end_pfn = max_pfn;
+		if (start_pfn < end_pfn)
+			__clear_bit_range(start_pfn, end_pfn - start_pfn);
 	}
 
 	u64 kernel_start_pfn = KERNEL_PHYSICAL_LOAD_ADDR >> PAGE_SHIFT;
 	u64 kernel_end_pfn = kernel_end >> PAGE_SHIFT;
 
-	for (u64 pfn = kernel_start_pfn; pfn < kernel_end_pfn; pfn++) {
-		if (!__test_bit(pfn)) {
-			__set_bit(pfn);
-			nr_free--;
-		}
-	}
+	if (kernel_end_pfn > max_pfn)
+		kernel_end_pfn = max_pfn;
+	if (kernel_start_pfn < kernel_end_pfn)
+		__set_bit_range(kernel_start_pfn,
+				kernel_end_pfn - kernel_start_pfn);
 
 	pr_debug("reserved %lu pages for kernel\n",
 		 kernel_end_pfn - kernel_start_pfn);
@@ -212,15 +962,33 @@ __reserve_system_pages(volatile struct limine_memmap_request *memmap_request,
 	u64 metadata_start_pfn = metadata_phys >> PAGE_SHIFT;
 	u64 metadata_pages = (metadata_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
 
-	for (u64 i = 0; i < metadata_pages; i++) {
-		u64 pfn = metadata_start_pfn + i;
-		if (!__test_bit(pfn)) {
-			__set_bit(pfn);
-			nr_free--;
-		}
-	}
+	__set_bit_range(metadata_start_pfn, metadata_pages);
 
 	pr_debug("reserved %lu pages for allocator metadata\n", metadata_pages);
+
+	/* The metadata never overlaps the kernel, see __find_metadata_location. */
+	for (int i = 0; i < MAX_NR_ZONES; i++) {
+		u64 start = zones[i].start_pfn;
+		u64 end = __zone_end_pfn(&zones[i]);
+		u64 lo, hi;
+
+		region_free[i] = 0;
+		if (start >= end)
+			continue;
+
+		region_free[i] = __usable_pages(memmap, start, end);
+
+		lo = kernel_start_pfn > start ? kernel_start_pfn : start;
+		hi = kernel_end_pfn < end ? kernel_end_pfn : end;
+		if (lo < hi)
+			region_free[i] -= __usable_pages(memmap, lo, hi);
+
+		lo = metadata_start_pfn > start ? metadata_start_pfn : start;
+		hi = metadata_start_pfn + metadata_pages;
+		hi = hi < end ? hi : end;
+		if (lo < hi)
+			region_free[i] -= __usable_pages(memmap, lo, hi);
+	}
 }
 
 void mem_init(volatile struct limine_memmap_request *memmap_request) {
@@ -228,7 +996,12 @@ void mem_init(volatile struct limine_memmap_request *memmap_request) {
 	u64 hhdm_offset;
 	phys_addr_t kernel_end;
 	phys_addr_t metadata_phys;
-	size_t bitmap_size, mem_map_size, metadata_size;
+	size_t bitmap_size, summary_size, sections_size, mem_map_size;
+	size_t metadata_size;
+	u64 nr_present_pages;
+	unsigned long region_free[MAX_NR_ZONES];
+	unsigned long nr_free, nr_deferred = 0;
+	u64 start_tsc = rdtsc();
 
 	if (!memmap_request || !memmap_request->response)
 		panic("invalid memmap request", NULL);
@@ -262,12 +1035,22 @@ void mem_init(volatile struct limine_memmap_request *memmap_request) {
 	pr_debug("managing %lu pages (0x%lx bytes)\n", max_pfn,
 		 max_pfn << PAGE_SHIFT);
 
-	bitmap_size = (max_pfn + 63) / 64 * sizeof(unsigned long);
-	mem_map_size = max_pfn * sizeof(struct page);
-	metadata_size = bitmap_size + mem_map_size;
+	nr_bitmap_words = (max_pfn + 63) / 64;
+	bitmap_size = nr_bitmap_words * sizeof(unsigned long);
+	summary_size = (nr_bitmap_words + 63) / 64 * sizeof(unsigned long);
+	nr_mem_sections = (max_pfn + PAGES_PER_SECTION - 1) >> PFN_SECTION_SHIFT;
+	sections_size = nr_mem_sections * sizeof(struct mem_section);
+	nr_present_pages = __sparse_init(memmap, NULL);
+	mem_map_size = nr_present_pages * sizeof(struct page);
+	metadata_size = bitmap_size + summary_size + sections_size + mem_map_size;
 
 	pr_debug("bitmap size: %lu bytes\n", bitmap_size);
-	pr_debug("mem_map size: %lu bytes\n", mem_map_size);
+	pr_debug("summary size: %lu bytes\n", summary_size);
+	pr_debug("section table size: %lu bytes\n", sections_size);
+	pr_debug("mem_map size: %lu bytes (%lu of %lu sections present)\n",
+		 mem_map_size,
+		 (nr_present_pages + PAGES_PER_SECTION - 1) >> PFN_SECTION_SHIFT,
+		 nr_mem_sections);
 	pr_debug("total metadata: %lu KiB\n", metadata_size / 1024);
 
 	kernel_end = __get_kernel_end(memmap_request);
@@ -281,76 +1064,698 @@ void mem_init(volatile struct limine_memmap_request *memmap_request) {
 	pr_info("metadata at physical 0x%lx\n", metadata_phys);
 
 	bitmap = (unsigned long *)(hhdm_offset + metadata_phys);
+	summary = (unsigned long *)(hhdm_offset + metadata_phys + bitmap_size);
+
+	/* Everything starts out used, including the tail bits past max_pfn. */
+	for (size_t i = 0; i < nr_bitmap_words; i++)
+		bitmap[i] = ~0UL;
+	for (size_t i = 0; i < summary_size / sizeof(unsigned long); i++)
+		summary[i] = 0;
+
+	mem_sections = (struct mem_section *)(hhdm_offset + metadata_phys +
+					      bitmap_size + summary_size);
+	for (size_t i = 0; i < nr_mem_sections; i++)
+		mem_sections[i].mem_map = NULL;
 
-	for (size_t i = 0; i < bitmap_size / sizeof(unsigned long); i++)
-		bitmap[i] = 0;
+	__sparse_init(memmap, (struct page *)((uintptr_t)mem_sections +
+					      sections_size));
 
 	__reserve_system_pages(memmap_request, kernel_end, metadata_phys,
-			       metadata_size);
+			       metadata_size, region_free);
 
-	__init_mem_map(hhdm_offset, metadata_phys + bitmap_size);
+	__init_free_areas(region_free);
+	__init_pcp_lists();
+
+	for (int i = 0; i < MAX_NR_ZONES; i++) {
+		struct zone *zone = &zones[i];
+		u64 end_pfn = zone->end_pfn < max_pfn ? zone->end_pfn : max_pfn;
+
+		if (zone->start_pfn >= max_pfn)
+			continue;
+		pr_info("zone %s: PFN 0x%lx-0x%lx, %lu MiB free, %lu MiB "
+			"deferred\n",
+			zone->name, zone->start_pfn, end_pfn,
+			(zone->nr_free << PAGE_SHIFT) >> 20,
+			(zone->nr_deferred << PAGE_SHIFT) >> 20);
+		nr_deferred += zone->nr_deferred;
+	}
 
-	pr_info("initialization complete\n");
+	nr_free = __nr_buddy_free() + nr_deferred;
+
+	wmark_low = max_pfn / PMM_WMARK_LOW_RATIO;
+	if (wmark_low < PMM_WMARK_LOW_MIN)
+		wmark_low = PMM_WMARK_LOW_MIN;
+	wmark_high = 2 * wmark_low;
+	reclaim_below = wmark_low;
+
+	pr_info("initialization complete in %lu TSC cycles\n",
+		rdtsc() - start_tsc);
 	pr_info("total: %lu MiB, free: %lu MiB, used: %lu MiB\n",
 		(max_pfn << PAGE_SHIFT) >> 20, (nr_free << PAGE_SHIFT) >> 20,
 		((max_pfn - nr_free) << PAGE_SHIFT) >> 20);
+	pr_info("watermarks: low %lu pages, high %lu pages\n", wmark_low,
+		wmark_high);
+}
+
+/**
+ * Memory compaction. A high-order allocation can fail while the zone has
+ * plenty of free pages, because the free space is scattered between pages
+ * that are in use. Some of those pages can be moved: their owner marked them
+ * with set_page_movable() and knows how to switch over to a copy.
+ *
+ * Two scanners run toward each other. The migrate scanner goes up from the
+ * bottom of the zone looking for movable pages, the free scanner comes down
+ * from the top taking free frames. Each movable page is copied up into a
+ * free frame, and its old frame is freed and merges with its buddies.
+ *
+ * The scanners run with `pmm_lock` held and interrupts off, so they let go
+ * of the lock every COMPACT_SCAN_BATCH frames. A zone without movable pages
+ * is not scanned at all.
+ */
+#define COMPACT_SCAN_BATCH 512
+
+static struct compact_stats compact_stats;
+
+void set_page_movable(struct page *page,
+		      const struct movable_operations *mops) {
+	if (!(page->flags & PG_movable))
+		__atomic_add_fetch(&__pfn_to_zone(page->pfn)->nr_movable, 1,
+				   __ATOMIC_RELAXED);
+	page->mops = mops;
+	page->flags |= PG_movable;
+}
+
+void clear_page_movable(struct page *page) {
+	if (!(page->flags & PG_movable))
+		return;
+
+	__atomic_sub_fetch(&__pfn_to_zone(page->pfn)->nr_movable, 1,
+			   __ATOMIC_RELAXED);
+	page->flags &= ~PG_movable;
+	page->mops = NULL;
+}
+
+/* Returns 1 if @zone has a free block of @order or bigger. */
+static int __zone_has_order(struct zone *zone, u32 order) {
+	for (; order < MAX_ORDER; order++)
+		if (zone->free_area[order].nr_free)
+			return 1;
+	return 0;
+}
+
+/**
+ * __compact_next_movable - Find a movable page in [*@pfn, @end).
+ *
+ * Looks at no more than *@budget frames, counting them off. Leaves *@pfn on
+ * the page found, or where the search stopped. Caller must hold `pmm_lock`.
+ */
+static struct page *__compact_next_movable(u64 *pfn, u64 end,
+					   unsigned long *budget) {
+	for (; *pfn < end && *budget; (*pfn)++, (*budget)--) {
+		struct page *page;
+
+		if (!pfn_valid(*pfn)) {
+			*pfn |= PAGE_SECTION_MASK;
+			continue;
+		}
+		if (!__test_bit(*pfn))
+			continue;
+
+		page = __pfn_to_page(*pfn);
+		if ((page->flags & (PG_movable | PG_pcp)) == PG_movable)
+			return page;
+	}
+
+	return NULL;
+}
+
+/**
+ * __compact_isolate_free - Take a free frame in [@floor, *@pfn) off the
+ * free lists, searching down from the top.
+ *
+ * Blocks of @order or bigger are left alone since they are what we are
+ * trying to build. Looks at no more than *@budget frames, counting them
+ * off. Leaves *@pfn on the frame taken, or where the search stopped. Caller
+ * must hold `pmm_lock`.
+ */
+static struct page *__compact_isolate_free(u64 *pfn, u64 floor, u32 order,
+					   unsigned long *budget) {
+	for (; *pfn > floor && *budget; (*budget)--) {
+		u64 cur = *pfn - 1;
+		struct page *head;
+
+		if (__test_bit(cur)) {
+			*pfn = cur;
+			continue;
+		}
+
+		head = __free_block_containing(cur);
+		if (!head)
+			panic("free frame 0x%lx is not on any free list", cur);
+
+		if (head->order >= order) {
+			*pfn = head->pfn;
+			continue;
+		}
+
+		__isolate_free_range(cur, 1);
+		*pfn = cur;
+		return __pfn_to_page(cur);
+	}
+
+	return NULL;
+}
+
+/**
+ * __compact_zone - Move pages in @zone until it has a free block of @order
+ * or the scanners meet.
+ *
+ * `pmm_lock` is dropped around the copy and the owner's callback, and
+ * whenever the scanners have used up a batch. Returns the number of pages
+ * moved.
+ */
+static unsigned long __compact_zone(struct zone *zone, u32 order) {
+	u64 migrate_pfn = zone->start_pfn;
+	u64 free_pfn = zone->init_end_pfn;
+	unsigned long budget = COMPACT_SCAN_BATCH;
+	unsigned long moved = 0;
+	u64 flags;
+
+	spin_lock_irqsave(&pmm_lock, flags);
+
+	while (!__zone_has_order(zone, order) &&
+	       __atomic_load_n(&zone->nr_movable, __ATOMIC_RELAXED)) {
+		const struct movable_operations *mops;
+		struct page *src, *dst;
+		int ret;
+
+		if (!budget) {
+			spin_unlock_irqrestore(&pmm_lock, flags);
+			budget = COMPACT_SCAN_BATCH;
+			spin_lock_irqsave(&pmm_lock, flags);
+		}
+
+		src = __compact_next_movable(&migrate_pfn, free_pfn, &budget);
+		if (!src) {
+			if (migrate_pfn < free_pfn)
+				continue;
+			break;
+		}
+
+		dst = __compact_isolate_free(&free_pfn, migrate_pfn + 1, order,
+					     &budget);
+		if (!dst) {
+			/* Look for a free frame again after the break. */
+			if (free_pfn > migrate_pfn + 1)
+				continue;
+			break;
+		}
+
+		mops = src->mops;
+		spin_unlock_irqrestore(&pmm_lock, flags);
+
+		copy_page(page_to_virt(dst), page_to_virt(src));
+		ret = mops->migrate_page(dst, src);
+
+		spin_lock_irqsave(&pmm_lock, flags);
+
+		if (ret == 0) {
+			clear_page_movable(src);
+			__free_one(src->pfn, 0);
+			moved++;
+		} else {
+			__free_one(dst->pfn, 0);
+		}
+		migrate_pfn++;
+	}
+
+	spin_unlock_irqrestore(&pmm_lock, flags);
+
+	return moved;
+}
+
+/**
+ * __alloc_pages_compact - Compact the zones @gfp allows and retry.
+ *
+ * Zones are compacted from the highest one down, stopping as soon as the
+ * allocation goes through.
+ */
+static struct page *__alloc_pages_compact(u32 order, gfp_t gfp) {
+	u64 start_tsc = rdtsc(), cycles;
+	unsigned long moved = 0;
+	struct page *page = NULL;
+	u64 flags;
+
+	for (int i = gfp_zone(gfp); i >= 0 && !page; i--) {
+		if (zones[i].start_pfn >= max_pfn ||
+		    !__atomic_load_n(&zones[i].nr_movable, __ATOMIC_RELAXED))
+			continue;
+
+		moved += __compact_zone(&zones[i], order);
+
+		spin_lock_irqsave(&pmm_lock, flags);
+		page = __rmqueue(order, gfp);
+		spin_unlock_irqrestore(&pmm_lock, flags);
+	}
+
+	cycles = rdtsc() - start_tsc;
+
+	compact_stats.runs++;
+	compact_stats.pages_moved += moved;
+	compact_stats.cycles += cycles;
+	if (page)
+		compact_stats.successes++;
+
+	pr_info("compaction for order %u moved %lu pages in %lu TSC cycles, "
+		"%s\n",
+		order, moved, cycles, page ? "succeeded" : "failed");
+
+	return page;
+}
+
+void compact_get_stats(struct compact_stats *stats) {
+	if (stats)
+		*stats = compact_stats;
+}
+
+/**
+ * __pmm_check_pressure - Reclaim if free memory is below the low watermark.
+ *
+ * Only called on the slow paths, when a per-CPU list was refilled or the
+ * buddy lists were used directly; a per-CPU list hit never reclaims. Uses
+ * the zone counters only. Pages on the per-CPU lists aren't counted, so
+ * this errs on the side of reclaiming a bit early.
+ *
+ * The shrinkers are asked to get free memory back up to the high watermark.
+ * If they fall short, they aren't asked again until free memory has dropped
+ * another PMM_RECLAIM_RETRY_PAGES, so a system that stays short of memory
+ * doesn't empty every cache on every refill.
+ */
+static void __pmm_check_pressure(void) {
+	unsigned long nr_free = 0, freed, below;
+
+	for (int i = 0; i < MAX_NR_ZONES; i++)
+		nr_free += zones[i].nr_free + zones[i].nr_deferred;
+
+	if (likely(nr_free >= wmark_low)) {
+		if (unlikely(__atomic_load_n(&reclaim_below,
+					     __ATOMIC_RELAXED) != wmark_low))
+			__atomic_store_n(&reclaim_below, wmark_low,
+					 __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (nr_free >= __atomic_load_n(&reclaim_below, __ATOMIC_RELAXED))
+		return;
+
+	freed = shrink_slab(wmark_high - nr_free);
+
+	below = wmark_low;
+	if (nr_free + freed < wmark_low)
+		below = nr_free + freed > PMM_RECLAIM_RETRY_PAGES
+			    ? nr_free + freed - PMM_RECLAIM_RETRY_PAGES
+			    : 0;
+	__atomic_store_n(&reclaim_below, below, __ATOMIC_RELAXED);
 }
 
-struct page *alloc_pages(u32 order) {
+struct page *alloc_pages_flags(u32 order, gfp_t gfp) {
 	size_t count = 1UL << order;
-	s64 start_pfn;
+	struct page *page;
+	u64 flags;
 
 	if (unlikely(!bitmap)) {
 		pr_warn("allocator not initialized\n");
 		return NULL;
 	}
 
-	if (unlikely(nr_free < count)) {
-		pr_warn("out of memory (need %lu pages, have %lu)\n", count,
-			nr_free);
+	if (unlikely(order >= MAX_ORDER)) {
+		pr_warn("order %u exceeds MAX_ORDER\n", order);
 		return NULL;
 	}
 
-	start_pfn = __find_free_pages(count);
-	if (unlikely(start_pfn < 0)) {
-		pr_warn("cannot find %lu contiguous pages\n", count);
+	/* The per-CPU lists don't care about zones, so DMA requests skip them. */
+	if (likely(order == 0 && gfp_zone(gfp) == ZONE_NORMAL)) {
+		bool refilled = false;
+
+		page = __pcp_alloc(&refilled);
+		if (unlikely(!page) && !(gfp & __GFP_NORECLAIM) &&
+		    shrink_slab(1))
+			page = __pcp_alloc(&refilled);
+		if (unlikely(!page)) {
+			pr_warn("out of memory (need 1 page)\n");
+			return NULL;
+		}
+		if (unlikely(refilled) && !(gfp & __GFP_NORECLAIM))
+			__pmm_check_pressure();
+		return page;
+	}
+
+	spin_lock_irqsave(&pmm_lock, flags);
+	page = __rmqueue(order, gfp);
+	spin_unlock_irqrestore(&pmm_lock, flags);
+
+	if (unlikely(!page)) {
+		/* Cached order-0 pages may be all that stands in the way. */
+		__pcp_drain_local();
+
+		spin_lock_irqsave(&pmm_lock, flags);
+		page = __rmqueue(order, gfp);
+		spin_unlock_irqrestore(&pmm_lock, flags);
+	}
+
+	/* Caches may be holding on to pages they don't need. */
+	if (unlikely(!page) && !(gfp & __GFP_NORECLAIM) && shrink_slab(count)) {
+		spin_lock_irqsave(&pmm_lock, flags);
+		page = __rmqueue(order, gfp);
+		spin_unlock_irqrestore(&pmm_lock, flags);
+	}
+
+	/* The free pages are there, they're just in the wrong places. */
+	if (unlikely(!page))
+		page = __alloc_pages_compact(order, gfp);
+
+	if (unlikely(!page)) {
+		pr_warn("cannot find %lu contiguous pages in zone %s or below "
+			"(%lu free)\n",
+			count, zones[gfp_zone(gfp)].name, __nr_buddy_free());
 		return NULL;
 	}
 
-	__mark_pages_inuse(start_pfn, count);
+	pr_debug("allocated %lu pages at PFN 0x%lx\n", count, page->pfn);
 
-	pr_debug("allocated %lu pages at PFN 0x%lx\n", count, start_pfn);
+	if (!(gfp & __GFP_NORECLAIM))
+		__pmm_check_pressure();
 
-	return &mem_map[start_pfn];
+	return page;
 }
 
 void free_pages(struct page *page, u32 order) {
 	size_t count = 1UL << order;
 	u64 start_pfn;
+	u64 flags;
 
 	if (unlikely(!bitmap || !page))
 		return;
 
 	start_pfn = page->pfn;
 
-	if (unlikely(start_pfn >= max_pfn)) {
-		pr_warn("invalid page frame number 0x%lx\n", start_pfn);
+	if (unlikely(order >= MAX_ORDER || start_pfn + count > max_pfn ||
+		     (start_pfn & (count - 1)))) {
+		pr_warn("invalid free of order %u at PFN 0x%lx\n", order,
+			start_pfn);
 		return;
 	}
 
-	for (size_t i = 0; i < count; i++) {
-		if (unlikely(!__test_bit(start_pfn + i))) {
+	if (likely(order == 0)) {
+		if (unlikely(page->flags & (PG_pcp | PG_buddy) ||
+			     !__test_bit(start_pfn))) {
 			pr_warn("double free detected at PFN 0x%lx\n",
-				start_pfn + i);
+				start_pfn);
 			return;
 		}
+		__pcp_free(page);
+		return;
+	}
+
+	spin_lock_irqsave(&pmm_lock, flags);
+
+	if (unlikely(!__test_bit_range(start_pfn, count))) {
+		spin_unlock_irqrestore(&pmm_lock, flags);
+		pr_warn("double free detected at PFN 0x%lx\n", start_pfn);
+		return;
 	}
 
-	__mark_pages_free(start_pfn, count);
+	__free_one(start_pfn, order);
+
+	spin_unlock_irqrestore(&pmm_lock, flags);
 
 	pr_debug("freed %lu pages at PFN 0x%lx\n", count, start_pfn);
 }
 
+struct page *alloc_contig_pages(unsigned long nr_pages, u32 align_order) {
+	struct page *page;
+	s64 start_pfn;
+	u64 flags;
+
+	if (unlikely(!bitmap || !nr_pages))
+		return NULL;
+
+	spin_lock_irqsave(&pmm_lock, flags);
+
+	__grow_all_zones();
+
+	start_pfn = __find_free_range(nr_pages, 1UL << align_order);
+	if (unlikely(start_pfn < 0)) {
+		spin_unlock_irqrestore(&pmm_lock, flags);
+		__pcp_drain_local();
+		spin_lock_irqsave(&pmm_lock, flags);
+		start_pfn = __find_free_range(nr_pages, 1UL << align_order);
+	}
+
+	if (unlikely(start_pfn < 0)) {
+		spin_unlock_irqrestore(&pmm_lock, flags);
+		pr_warn("cannot find %lu contiguous pages\n", nr_pages);
+		return NULL;
+	}
+
+	__isolate_free_range(start_pfn, nr_pages);
+	page = __pfn_to_page(start_pfn);
+
+	spin_unlock_irqrestore(&pmm_lock, flags);
+
+	pr_debug("allocated %lu contiguous pages at PFN 0x%lx\n", nr_pages,
+		 start_pfn);
+
+	return page;
+}
+
+void free_contig_pages(struct page *page, unsigned long nr_pages) {
+	u64 flags;
+
+	if (unlikely(!bitmap || !page || !nr_pages))
+		return;
+
+	if (unlikely(page->pfn + nr_pages > max_pfn)) {
+		pr_warn("invalid free of %lu pages at PFN 0x%lx\n", nr_pages,
+			page->pfn);
+		return;
+	}
+
+	spin_lock_irqsave(&pmm_lock, flags);
+
+	if (unlikely(!__test_bit_range(page->pfn, nr_pages))) {
+		spin_unlock_irqrestore(&pmm_lock, flags);
+		pr_warn("double free detected at PFN 0x%lx\n", page->pfn);
+		return;
+	}
+
+	__free_range(page->pfn, nr_pages);
+
+	spin_unlock_irqrestore(&pmm_lock, flags);
+
+	pr_debug("freed %lu contiguous pages at PFN 0x%lx\n", nr_pages,
+		 page->pfn);
+}
+
+static const u32 hpage_order[NR_HPAGE_SIZES] = {
+    [HPAGE_PMD] = HPAGE_PMD_ORDER,
+    [HPAGE_PUD] = HPAGE_PUD_ORDER,
+};
+
+static struct hpage_stats hpage_stats[NR_HPAGE_SIZES];
+
+struct page *alloc_huge_page(enum hpage_size size) {
+	struct page *page;
+	u32 order;
+
+	if (unlikely(size >= NR_HPAGE_SIZES))
+		return NULL;
+
+	order = hpage_order[size];
+	if (order < MAX_ORDER)
+		page = alloc_pages(order);
+	else
+		page = alloc_contig_pages(1UL << order, order);
+
+	/* No lock is held here, and other CPUs may be counting too. */
+	if (likely(page))
+		__atomic_fetch_add(&hpage_stats[size].allocs, 1,
+				   __ATOMIC_RELAXED);
+	else
+		__atomic_fetch_add(&hpage_stats[size].failures, 1,
+				   __ATOMIC_RELAXED);
+
+	return page;
+}
+
+void free_huge_page(struct page *page, enum hpage_size size) {
+	u32 order;
+
+	if (unlikely(!page || size >= NR_HPAGE_SIZES))
+		return;
+
+	order = hpage_order[size];
+	if (order < MAX_ORDER)
+		free_pages(page, order);
+	else
+		free_contig_pages(page, 1UL << order);
+}
+
+/**
+ * __nr_free_aligned - Count the naturally aligned 2^order blocks that are
+ * entirely free. Frames in deferred chunks count, cached pcp pages don't.
+ *
+ * Caller must hold `pmm_lock`.
+ */
+static unsigned long __nr_free_aligned(u32 order) {
+	u64 mask = (1UL << order) - 1;
+	u64 pfn = 0, start, end;
+	unsigned long nr = 0;
+
+	while (__next_free_run(pfn, &start, &end) == 0) {
+		u64 first = (start + mask) & ~mask;
+		u64 last = end & ~mask;
+
+		if (first < last)
+			nr += (last - first) >> order;
+		pfn = end;
+	}
+
+	return nr;
+}
+
+int hpage_get_stats(enum hpage_size size, struct hpage_stats *stats) {
+	u64 flags;
+
+	if (size >= NR_HPAGE_SIZES || !stats)
+		return -1;
+
+	stats->allocs =
+	    __atomic_load_n(&hpage_stats[size].allocs, __ATOMIC_RELAXED);
+	stats->failures =
+	    __atomic_load_n(&hpage_stats[size].failures, __ATOMIC_RELAXED);
+
+	if (unlikely(!bitmap)) {
+		stats->available = 0;
+		return 0;
+	}
+
+	spin_lock_irqsave(&pmm_lock, flags);
+	stats->available = __nr_free_aligned(hpage_order[size]);
+	spin_unlock_irqrestore(&pmm_lock, flags);
+
+	return 0;
+}
+
+unsigned long free_reserved_area(phys_addr_t start, phys_addr_t end,
+				 const char *name) {
+	u64 start_pfn = PFN_UP(start);
+	u64 end_pfn = PFN_DOWN(end);
+	unsigned long freed = 0;
+	u64 flags;
+
+	if (unlikely(!bitmap))
+		return 0;
+
+	if (end_pfn > max_pfn)
+		end_pfn = max_pfn;
+
+	spin_lock_irqsave(&pmm_lock, flags);
+
+	/* Frames we give back must not sit in a chunk that is set up later. */
+	for (int i = 0; i < MAX_NR_ZONES; i++) {
+		u64 zone_end = __zone_end_pfn(&zones[i]);
+
+		if (start_pfn < zone_end && end_pfn > zones[i].start_pfn)
+			__zone_grow(&zones[i],
+				    end_pfn < zone_end ? end_pfn : zone_end);
+	}
+
+	for (u64 pfn = start_pfn; pfn < end_pfn;) {
+		u64 run_end = pfn;
+
+		while (run_end < end_pfn && pfn_valid(run_end) &&
+		       __test_bit(run_end))
+			run_end++;
+
+		if (run_end == pfn) {
+			pfn++;
+			continue;
+		}
+
+		__free_range(pfn, run_end - pfn);
+		freed += run_end - pfn;
+		pfn = run_end;
+	}
+
+	spin_unlock_irqrestore(&pmm_lock, flags);
+
+	pr_info("freed %lu KiB of %s memory\n", freed << (PAGE_SHIFT - 10),
+		name);
+
+	return freed;
+}
+
+void pcp_set_watermarks(unsigned int low, unsigned int high) {
+	unsigned long flags;
+
+	if (!low || high <= low) {
+		pr_warn("invalid pcp watermarks low=%u high=%u\n", low, high);
+		return;
+	}
+
+	flags = local_irq_save();
+	pcp_low = low;
+	pcp_high = high;
+	local_irq_restore(flags);
+
+	pr_info("pcp watermarks set to low=%u high=%u\n", low, high);
+}
+
+void pmm_set_watermarks(unsigned long low, unsigned long high) {
+	if (high <= low) {
+		pr_warn("invalid watermarks low=%lu high=%lu\n", low, high);
+		return;
+	}
+
+	wmark_low = low;
+	wmark_high = high;
+	__atomic_store_n(&reclaim_below, low, __ATOMIC_RELAXED);
+
+	pr_info("watermarks set to low=%lu high=%lu\n", low, high);
+}
+
+void pmm_get_watermarks(unsigned long *low, unsigned long *high) {
+	if (low)
+		*low = wmark_low;
+	if (high)
+		*high = wmark_high;
+}
+
+int pcp_get_stats(unsigned int cpu, struct pcp_stats *stats) {
+	if (cpu >= NR_CPUS || !stats)
+		return -1;
+
+	*stats = pcp_lists[cpu].stats;
+	stats->count = pcp_lists[cpu].count;
+	return 0;
+}
+
+/**
+ * Pages sitting on the per-CPU lists, or in chunks we haven't initialized
+ * yet, are free as far as users care.
+ */
+static u64 __nr_free_pages(void) {
+	u64 total = __nr_buddy_free();
+
+	for (int i = 0; i < MAX_NR_ZONES; i++)
+		total += zones[i].nr_deferred;
+
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++)
+		total += pcp_lists[cpu].count;
+	return total;
+}
+
 phys_addr_t page_to_phys(struct page *page) {
 	if (!page)
 		return 0;
@@ -359,18 +1764,41 @@ phys_addr_t page_to_phys(struct page *page) {
 
 struct page *phys_to_page(phys_addr_t phys) {
 	u64 pfn = phys >> PAGE_SHIFT;
+	struct zone *zone;
+	u64 flags;
 
-	if (pfn >= max_pfn)
+	if (!pfn_valid(pfn))
 		return NULL;
 
-	return &mem_map[pfn];
+	/* Looking up a page in a deferred chunk initializes it first. */
+	zone = __pfn_to_zone(pfn);
+	if (unlikely(pfn >= zone->init_end_pfn)) {
+		spin_lock_irqsave(&pmm_lock, flags);
+		__zone_grow(zone, pfn + 1);
+		spin_unlock_irqrestore(&pmm_lock, flags);
+	}
+
+	return __pfn_to_page(pfn);
+}
+
+int pfn_valid(u64 pfn) {
+	return pfn < max_pfn &&
+	       mem_sections[pfn >> PFN_SECTION_SHIFT].mem_map != NULL;
+}
+
+unsigned long nr_free_zone_pages(enum zone_type zone) {
+	if (zone >= MAX_NR_ZONES)
+		return 0;
+	return zones[zone].nr_free + zones[zone].nr_deferred;
 }
 
 u64 totalram_pages(void) { return max_pfn << PAGE_SHIFT; }
 
-u64 freeram_pages(void) { return nr_free << PAGE_SHIFT; }
+u64 freeram_pages(void) { return __nr_free_pages() << PAGE_SHIFT; }
 
-u64 usedram_pages(void) { return (max_pfn - nr_free) << PAGE_SHIFT; }
+u64 usedram_pages(void) {
+	return (max_pfn - __nr_free_pages()) << PAGE_SHIFT;
+}
 
 static int __init pmm_setup(void) {
 	mem_init(&memmap_request);
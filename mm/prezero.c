@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#define pr_fmt(fmt) "prezero: " fmt
+
+#include <asm/page.h>
+#include <seren/init.h>
+#include <seren/list.h>
+#include <seren/mm/pmm.h>
+#include <seren/mm/prezero.h>
+#include <seren/mm/shrinker.h>
+#include <seren/printk.h>
+#include <seren/spinlock.h>
+
+/**
+ * The pool is a plain list of pages that were zeroed while the CPU had
+ * nothing better to do. The pages are allocated as far as the PMM is
+ * concerned, so `page->list` is ours to use.
+ */
+static LIST_HEAD(zeroed_pages);
+static unsigned long nr_zeroed;
+static struct prezero_stats stats;
+
+static spinlock_t prezero_lock = SPIN_LOCK_UNLOCKED;
+
+/**
+ * Pages in the pool are only referenced from the list, so compaction may
+ * move them. A page that was handed out in the meantime is no longer
+ * movable and stays where it is.
+ */
+static int prezero_migrate_page(struct page *dst, struct page *src) {
+	u64 flags;
+
+	spin_lock_irqsave(&prezero_lock, flags);
+	if (!(src->flags & PG_movable)) {
+		spin_unlock_irqrestore(&prezero_lock, flags);
+		return -1;
+	}
+
+	list_replace(&src->list, &dst->list);
+	set_page_movable(dst, src->mops);
+	clear_page_movable(src);
+	spin_unlock_irqrestore(&prezero_lock, flags);
+
+	return 0;
+}
+
+static const struct movable_operations prezero_mops = {
+    .migrate_page = prezero_migrate_page,
+};
+
+struct page *alloc_page_zeroed(void) {
+	struct page *page = NULL;
+	u64 flags;
+
+	spin_lock_irqsave(&prezero_lock, flags);
+	if (likely(!list_empty(&zeroed_pages))) {
+		page = list_first_entry(&zeroed_pages, struct page, list);
+		list_del(&page->list);
+		clear_page_movable(page);
+		nr_zeroed--;
+		stats.hits++;
+	} else {
+		stats.misses++;
+	}
+	spin_unlock_irqrestore(&prezero_lock, flags);
+
+	if (page)
+		return page;
+
+	page = alloc_page();
+	if (page)
+		clear_page(page_to_virt(page));
+
+	return page;
+}
+
+/**
+ * Only fill the pool while free memory is above the PMM's high watermark.
+ * Anywhere below it, the pages we take could push the allocator under its
+ * low watermark, and reclaim would hand the pool straight back, over and
+ * over. The allocations themselves never reclaim for the same reason.
+ */
+unsigned int prezero_refill(unsigned int budget) {
+	unsigned int filled = 0;
+	unsigned long wmark_high;
+
+	pmm_get_watermarks(NULL, &wmark_high);
+
+	while (filled < budget && nr_zeroed < PREZERO_POOL_SIZE &&
+	       (freeram_pages() >> PAGE_SHIFT) > wmark_high) {
+		struct page *page;
+		u64 flags;
+
+		page = alloc_pages_flags(0, GFP_KERNEL | __GFP_NORECLAIM);
+		if (!page)
+			break;
+
+		/* The slow part runs with interrupts on and no lock held. */
+		clear_page_nocache(page_to_virt(page));
+
+		spin_lock_irqsave(&prezero_lock, flags);
+		list_add_tail(&page->list, &zeroed_pages);
+		set_page_movable(page, &prezero_mops);
+		nr_zeroed++;
+		stats.filled++;
+		spin_unlock_irqrestore(&prezero_lock, flags);
+
+		filled++;
+	}
+
+	return filled;
+}
+
+/**
+ * The pool is only a cache, so under memory pressure its pages are handed
+ * back. The idle loop will refill it once there is room again.
+ */
+static unsigned long prezero_count(struct shrinker *s) {
+	(void)s;
+	return nr_zeroed;
+}
+
+static unsigned long prezero_scan(struct shrinker *s, unsigned long nr) {
+	LIST_HEAD(victims);
+	unsigned long freed = 0;
+	struct page *page;
+	u64 flags;
+
+	(void)s;
+
+	flags = local_irq_save();
+	if (!spin_trylock(&prezero_lock)) {
+		local_irq_restore(flags);
+		return 0;
+	}
+	while (freed < nr && !list_empty(&zeroed_pages)) {
+		page = list_first_entry(&zeroed_pages, struct page, list);
+		list_move(&page->list, &victims);
+		clear_page_movable(page);
+		nr_zeroed--;
+		freed++;
+	}
+	spin_unlock_irqrestore(&prezero_lock, flags);
+
+	while (!list_empty(&victims)) {
+		page = list_first_entry(&victims, struct page, list);
+		list_del(&page->list);
+		free_page(page);
+	}
+
+	return freed;
+}
+
+static struct shrinker prezero_shrinker = {
+    .count_pages = prezero_count,
+    .scan_pages = prezero_scan,
+};
+
+static int __init prezero_init(void) {
+	register_shrinker(&prezero_shrinker);
+	return 0;
+}
+
+postcore_initcall(prezero_init);
+
+void prezero_get_stats(struct prezero_stats *out) {
+	u64 flags;
+
+	if (!out)
+		return;
+
+	spin_lock_irqsave(&prezero_lock, flags);
+	*out = stats;
+	out->count = nr_zeroed;
+	spin_unlock_irqrestore(&prezero_lock, flags);
+}
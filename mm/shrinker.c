@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (C) 2025 Arda Yetistiren
+ */
+
+#include <seren/list.h>
+#include <seren/mm/shrinker.h>
+#include <seren/spinlock.h>
+
+static LIST_HEAD(shrinkers);
+static struct shrink_stats stats;
+
+/**
+ * Protects the shrinker list. shrink_slab() holds it across the callbacks,
+ * which is also what keeps an allocation made from inside a shrinker from
+ * starting another round of shrinking.
+ */
+static spinlock_t shrinker_lock = SPIN_LOCK_UNLOCKED;
+
+void register_shrinker(struct shrinker *s) {
+	u64 flags;
+
+	spin_lock_irqsave(&shrinker_lock, flags);
+	list_add_tail(&s->list, &shrinkers);
+	spin_unlock_irqrestore(&shrinker_lock, flags);
+}
+
+void unregister_shrinker(struct shrinker *s) {
+	u64 flags;
+
+	spin_lock_irqsave(&shrinker_lock, flags);
+	list_del(&s->list);
+	spin_unlock_irqrestore(&shrinker_lock, flags);
+}
+
+unsigned long shrink_slab(unsigned long nr) {
+	struct list_head *pos;
+	unsigned long freed = 0;
+	u64 flags;
+
+	flags = local_irq_save();
+	if (!spin_trylock(&shrinker_lock)) {
+		local_irq_restore(flags);
+		return 0;
+	}
+
+	list_for_each(pos, &shrinkers) {
+		struct shrinker *s = list_entry(pos, struct shrinker, list);
+
+		if (freed >= nr)
+			break;
+		if (!s->count_pages(s))
+			continue;
+		freed += s->scan_pages(s, nr - freed);
+	}
+
+	stats.runs++;
+	stats.requested += nr;
+	stats.freed += freed;
+
+	spin_unlock_irqrestore(&shrinker_lock, flags);
+
+	return freed;
+}
+
+void shrink_get_stats(struct shrink_stats *out) {
+	u64 flags;
+
+	spin_lock_irqsave(&shrinker_lock, flags);
+	*out = stats;
+	spin_unlock_irqrestore(&shrinker_lock, flags);
+}
@@ -5,14 +5,19 @@
 
 #define pr_fmt(fmt) "slab: " fmt
 
+#include <asm/processor.h>
 #include <lib/string.h>
+#include <seren/fs/devicefs.h>
 #include <seren/init.h>
 #include <seren/list.h>
 #include <seren/mm.h>
 #include <seren/mm/pmm.h>
+#include <seren/mm/shrinker.h>
 #include <seren/mm/slab.h>
 #include <seren/panic.h>
 #include <seren/printk.h>
+#include <seren/smp.h>
+#include <seren/spinlock.h>
 #include <seren/stddef.h>
 #include <seren/types.h>
 
@@ -22,44 +27,149 @@ static inline size_t __align_up(size_t size, size_t align) {
 
 /**
  * We bould our free lists by storing a pointer to the next free object
- * inside the storage of the current free object.
+ * inside the storage of the current free object. Caches with a constructor
+ * keep it past the end of the object instead, so that free objects stay
+ * constructed.
  */
-static inline void *__obj_set_next(void *obj, void *next) {
-	*(void **)obj = next;
+static inline void *__obj_set_next(struct kmem_cache *cache, void *obj,
+				   void *next) {
+	*(void **)((char *)obj + cache->offset) = next;
 	return obj;
 }
 
-static inline void *__obj_get_next(void *obj) { return *(void **)obj; }
+static inline void *__obj_get_next(struct kmem_cache *cache, void *obj) {
+	return *(void **)((char *)obj + cache->offset);
+}
 
 static struct kmem_cache kmalloc_caches[KMALLOC_NUM_CACHES];
 static int kmalloc_caches_inited;
 
-static inline struct slab *__list_to_slab(struct list_head *head) {
-	return (struct slab *)((char *)head - offsetof(struct slab, list));
-}
-static inline void __slab_list_add(struct slab *sl, struct list_head *head) {
-	list_add(&sl->list, head);
-}
-static inline void __slab_list_del(struct slab *sl) { list_del(&sl->list); }
-static inline struct slab *__slab_list_first(struct list_head *head) {
+/**
+ * Caches made by kmem_cache_create() come from here. Their magazines are
+ * cache line aligned, which kmalloc() can't promise for something this big.
+ */
+static struct kmem_cache kmem_cache_cache;
+
+/* Every cache, for the shrinker. Protected by `slab_caches_lock`. */
+static LIST_HEAD(slab_caches);
+static spinlock_t slab_caches_lock = SPIN_LOCK_UNLOCKED;
+
+/* Must agree with kmalloc_index(). */
+static const char *const kmalloc_names[KMALLOC_NUM_CACHES] = {
+    "kmalloc-8",   "kmalloc-16",  "kmalloc-32",	  "kmalloc-64",
+    "kmalloc-96",  "kmalloc-128", "kmalloc-192",  "kmalloc-256",
+    "kmalloc-384", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+    "kmalloc-4096",
+};
+static const unsigned int kmalloc_sizes[KMALLOC_NUM_CACHES] = {
+    8, 16, 32, 64, 96, 128, 192, 256, 384, 512, 1024, 2048, 4096,
+};
+
+/**
+ * Class index for sizes up to KMALLOC_TABLE_MAX, one entry per 8 bytes:
+ * `size_index[(size - 1) / 8]`. Above that the classes are plain powers of
+ * two and index 9 is 512 bytes, so the index is just fls(size - 1).
+ */
+#define KMALLOC_TABLE_MAX 512
+static u8 size_index[KMALLOC_TABLE_MAX / 8];
+
+/**
+ * log2 of the distance from each kmalloc class to the next smaller one,
+ * which is always a power of two, so picking a bucket needs no division.
+ */
+static unsigned int kmalloc_hist_shift[KMALLOC_NUM_CACHES];
+
+/**
+ * struct kmalloc_cpu_hist - One CPU's request histograms
+ * @class: Counters of each kmalloc class; `size` is left at 0
+ *
+ * Like the magazines, only touched by its own CPU with interrupts disabled
+ * and kept on cache lines of its own. kmalloc_get_class_stats() sums them.
+ */
+struct kmalloc_cpu_hist {
+	struct kmalloc_class_stats class[KMALLOC_NUM_CACHES];
+} ____cacheline_aligned;
+
+static struct kmalloc_cpu_hist kmalloc_cpu_hists[NR_CPUS];
+
+static inline struct page *__slab_list_first(struct list_head *head) {
 	if (list_empty(head))
 		return NULL;
-	return __list_to_slab(head->next);
+	return list_first_entry(head, struct page, list);
 }
 
 /**
- * __slab_create - Allocate a new page and format it as a slab.
+ * __slab_order - Pick the slab order for objects of @size.
+ * @cache: Gets its `order`, `objects` and `waste` filled in
+ *
+ * Takes the smallest order whose waste is within 1/SLAB_WASTE_FRACTION of
+ * the slab. If none is, the order that wastes the smallest share wins.
+ */
+static void __slab_order(struct kmem_cache *cache) {
+	size_t best_waste = 0, best_bytes = 0;
+
+	cache->order = 0;
+	cache->objects = 0;
+
+	for (u32 order = 0; order <= SLAB_MAX_ORDER; order++) {
+		size_t bytes = PAGE_SIZE << order;
+		size_t objects, waste;
+
+		if (bytes < cache->size)
+			continue;
+
+		objects = bytes / cache->size;
+		waste = bytes - objects * cache->size;
+
+		/* waste / bytes < best_waste / best_bytes, without dividing */
+		if (!cache->objects ||
+		    waste * best_bytes < best_waste * bytes) {
+			cache->order = order;
+			cache->objects = objects;
+			best_waste = waste;
+			best_bytes = bytes;
+		}
+
+		if (waste * SLAB_WASTE_FRACTION <= bytes)
+			break;
+	}
+
+	cache->waste = best_waste;
+}
+
+/* Tags or untags every page of a slab, see virt_to_slab_page(). */
+static void __slab_mark_pages(struct page *page, u32 order, int set) {
+	phys_addr_t phys = page_to_phys(page);
+
+	for (unsigned long i = 0; i < (1UL << order); i++) {
+		struct page *pg = phys_to_page(phys + i * PAGE_SIZE);
+
+		if (set) {
+			pg->flags |= PG_slab;
+			pg->order = order;
+		} else {
+			pg->flags &= ~PG_slab;
+			pg->order = 0;
+		}
+	}
+}
+
+/**
+ * __slab_create - Allocate new pages and format them as a slab.
  * @cache: The cache that this new slab will belong to.
  *
  * This is called when a cache runs out of free objects and needs more memory.
- * It gets a fresh page from the PMM, places a `struct slab` header at the
- * start, and then carves up the rest of the page into objects, adding them
- * all to an internal free list.
+ * It gets 2^order fresh pages from the PMM and carves all of them up into
+ * objects, adding them to the slab's free list and running the cache's
+ * constructor on each. The bookkeeping lives in the first page's
+ * `struct page`, so nothing else in the slab is written.
+ *
+ * The first object is pushed in by the cache's next colour, using up some
+ * of the space a slab wastes anyway. Objects at the same index in two slabs
+ * then land in different cache sets instead of fighting over the same ones.
  */
-static struct slab *__slab_create(struct kmem_cache *cache) {
-	struct page *page = alloc_page();
-	void *page_base;
-	struct slab *sl;
+static struct page *__slab_create(struct kmem_cache *cache) {
+	struct page *page = alloc_pages(cache->order);
 	uintptr_t cursor;
 	uintptr_t end;
 	unsigned int count = 0;
@@ -67,49 +177,74 @@ static struct slab *__slab_create(struct kmem_cache *cache) {
 	if (!page)
 		return NULL;
 
-	page_base = page_to_virt(page);
-	sl = (struct slab *)page_base;
-	sl->magic = SLAB_PAGE_MAGIC;
-	sl->cache = cache;
-	sl->page = page;
-	sl->inuse = 0;
-	sl->free_list = NULL;
-	INIT_LIST_HEAD(&sl->list);
+	__slab_mark_pages(page, cache->order, 1);
+
+	page->slab_cache = cache;
+	page->freelist = NULL;
+	page->inuse = 0;
+	INIT_LIST_HEAD(&page->list);
 
-	/* place objects after slab header */
-	cursor = __align_up((uintptr_t)page_base + sizeof(struct slab),
-			    cache->align);
-	end = (uintptr_t)page_base + PAGE_SIZE;
+	cursor = (uintptr_t)page_to_virt(page);
+	end = cursor + (PAGE_SIZE << cache->order);
+
+	cursor += (uintptr_t)cache->colour_next * cache->colour_off;
+	if (++cache->colour_next >= cache->colour)
+		cache->colour_next = 0;
 
 	while (cursor + cache->size <= end) {
 		void *obj = (void *)cursor;
-		sl->free_list = __obj_set_next(obj, sl->free_list);
+		if (cache->ctor)
+			cache->ctor(obj);
+		page->freelist = __obj_set_next(cache, obj, page->freelist);
 		count++;
 		cursor += cache->size;
 	}
 
-	sl->total = (u16)count;
-	if (count == 0) {
-		free_page(page);
-		return NULL;
-	}
+	page->objects = (u16)count;
+	cache->slabs_created++;
 
-	pr_debug("kmem_cache '%s': new slab %p (objsz=%lu, total=%u)\n",
-		 cache->name, sl, (unsigned long)cache->size, sl->total);
+	pr_debug("kmem_cache '%s': new slab at PFN 0x%lx (objsz=%lu, "
+		 "total=%u)\n",
+		 cache->name, page->pfn, (unsigned long)cache->size,
+		 page->objects);
 
-	return sl;
+	return page;
 }
 
-static void __slab_release(struct slab *sl) {
-	if (sl->magic != SLAB_PAGE_MAGIC)
-		panic("release: invalid slab magic", NULL);
-	pr_debug("kmem_cache '%s': release slab %p\n", sl->cache->name, sl);
-	free_page(sl->page);
+static void __slab_release(struct page *slab) {
+	struct kmem_cache *cache = slab->slab_cache;
+
+	pr_debug("kmem_cache '%s': release slab at PFN 0x%lx\n", cache->name,
+		 slab->pfn);
+
+	if (cache->dtor) {
+		for (void *obj = slab->freelist; obj;
+		     obj = __obj_get_next(cache, obj))
+			cache->dtor(obj);
+	}
+
+	cache->slabs_released++;
+	slab->slab_cache = NULL;
+	slab->freelist = NULL;
+	__slab_mark_pages(slab, cache->order, 0);
+	free_pages(slab, cache->order);
 }
 
-static void *__slab_alloc(struct kmem_cache *cache) {
-	struct slab *sl;
-	void *obj;
+/**
+ * __slab_alloc_bulk - Take up to @nr objects off one slab.
+ * @cache: The cache, whose lock the caller holds
+ * @nr: How many objects are wanted
+ * @p: Where to store them
+ *
+ * Walks the free list of a single slab and fixes up its list position once
+ * for the whole batch. Returns how many objects were taken, which is less
+ * than @nr when the slab runs out and 0 only when no slab can be made.
+ */
+static unsigned int __slab_alloc_bulk(struct kmem_cache *cache, size_t nr,
+				      void **p) {
+	struct page *slab;
+	int was_free = 0;
+	unsigned int count = 0;
 
 	/**
 	 * The allocation strategy is simple:
@@ -118,123 +253,265 @@ static void *__slab_alloc(struct kmem_cache *cache) {
 	 * 3. If none, create a brand new slab.
 	 */
 	if (!list_empty(&cache->partial)) {
-		sl = __slab_list_first(&cache->partial);
+		slab = __slab_list_first(&cache->partial);
 	} else if (!list_empty(&cache->free)) {
-		sl = __slab_list_first(&cache->free);
+		slab = __slab_list_first(&cache->free);
+		was_free = 1;
 	} else {
-		sl = NULL;
+		slab = NULL;
 	}
 
-	if (!sl) {
-		sl = __slab_create(cache);
-		if (!sl)
-			return NULL;
-		__slab_list_add(sl, &cache->free);
+	if (!slab) {
+		slab = __slab_create(cache);
+		if (!slab)
+			return 0;
+		list_add(&slab->list, &cache->free);
 		cache->nr_free_slabs++;
+		was_free = 1;
 	}
 
-	obj = sl->free_list;
-	sl->free_list = __obj_get_next(obj);
-	sl->inuse++;
+	while (count < nr && slab->freelist) {
+		void *obj = slab->freelist;
 
-	pr_debug("kmem_cache '%s': alloc obj %p (slab %p inuse=%u/%u)\n",
-		 cache->name, obj, sl, sl->inuse, sl->total);
+		slab->freelist = __obj_get_next(cache, obj);
+		p[count++] = obj;
+	}
+	slab->inuse += count;
 
 	/**
 	 * If it just became full, move it to the `full` list.
 	 * If it was free and is now partially used, move it to the `partial`
 	 * list.
 	 */
-	if (sl->inuse == sl->total) { /* partial -> full */
-		__slab_list_del(sl);
-		__slab_list_add(sl, &cache->full);
-		if (cache->nr_free_slabs)
+	if (slab->inuse == slab->objects) { /* partial or free -> full */
+		list_move(&slab->list, &cache->full);
+		if (was_free)
 			cache->nr_free_slabs--;
 
-	} else if (!list_empty(&cache->free) && /* free -> partial */
-		   sl == __slab_list_first(&cache->free)) {
-		__slab_list_del(sl);
-		__slab_list_add(sl, &cache->partial);
-		if (cache->nr_free_slabs)
-			cache->nr_free_slabs--;
+	} else if (was_free) { /* free -> partial */
+		list_move(&slab->list, &cache->partial);
+		cache->nr_free_slabs--;
 	}
 
-	if (cache->ctor)
-		cache->ctor(obj);
-
-	return obj;
+	return count;
 }
 
-static void __slab_try_reclaim(struct kmem_cache *cache) {
-	while (cache->nr_free_slabs > 1 && !list_empty(&cache->free)) {
-		struct slab *victim = __slab_list_first(&cache->free);
-		pr_debug("kmem_cache '%s': reclaim slab %p (free_slabs=%u)\n",
-			 cache->name, victim, cache->nr_free_slabs);
-		__slab_list_del(victim);
+/**
+ * __slab_shrink - Release free slabs until at most @keep are left.
+ * @cache: The cache, whose lock the caller holds
+ * @keep: How many free slabs to hang on to
+ *
+ * Returns the number of pages given back to the page allocator.
+ */
+static unsigned long __slab_shrink(struct kmem_cache *cache,
+				   unsigned int keep) {
+	unsigned long freed = 0;
+
+	while (cache->nr_free_slabs > keep && !list_empty(&cache->free)) {
+		struct page *victim = __slab_list_first(&cache->free);
+		pr_debug("kmem_cache '%s': reclaim slab at PFN 0x%lx "
+			 "(free_slabs=%u)\n",
+			 cache->name, victim->pfn, cache->nr_free_slabs);
+		list_del(&victim->list);
 		__slab_release(victim);
 		cache->nr_free_slabs--;
+		freed += 1UL << cache->order;
 	}
+
+	return freed;
 }
 
-static void __slab_free(struct kmem_cache *cache, void *obj) {
-	struct page *pg = virt_to_page(obj);
-	void *page_base = page_to_virt(pg);
-	struct slab *sl = (struct slab *)page_base;
+static inline int __slab_contains(struct kmem_cache *cache,
+				  struct page *slab, void *obj) {
+	uintptr_t start = (uintptr_t)page_to_virt(slab);
+
+	return (uintptr_t)obj >= start &&
+	       (uintptr_t)obj < start + (PAGE_SIZE << cache->order);
+}
 
-	if (sl->magic != SLAB_PAGE_MAGIC || sl->cache != cache)
+/**
+ * An object freed into a magazine may be handed out again before it ever
+ * reaches its slab, so catch frees to the wrong cache right away.
+ */
+static inline void __slab_check_free(struct kmem_cache *cache,
+				     struct page *slab, void *obj) {
+	if (unlikely(!slab || slab->slab_cache != cache))
 		panic("invalid slab free %p", obj);
+}
 
-	if (cache->dtor)
-		cache->dtor(obj);
+/**
+ * __slab_free_bulk - Put @nr objects back on their slabs.
+ * @cache: The cache, whose lock the caller holds
+ * @nr: How many objects there are
+ * @p: The objects
+ *
+ * Runs of objects from the same slab are chained together and handed back
+ * in one go, so the slab's counters and list position are only touched
+ * once per run. Free slabs beyond SLAB_MAX_FREE_SLABS are released
+ * afterwards.
+ *
+ * Returns the number of pages given back to the page allocator.
+ */
+static unsigned long __slab_free_bulk(struct kmem_cache *cache, size_t nr,
+				      void **p) {
+	size_t i = 0;
 
-	__obj_set_next(obj, sl->free_list);
-	sl->free_list = obj;
+	while (i < nr) {
+		struct page *slab = virt_to_slab_page(p[i]);
+		void *head = p[i], *tail = p[i];
+		unsigned int count = 1;
 
-	if (sl->inuse == sl->total) {
-		__slab_list_del(sl);
-		__slab_list_add(sl, &cache->partial);
-	}
+		__slab_check_free(cache, slab, p[i]);
 
-	sl->inuse--;
+		for (i++; i < nr && __slab_contains(cache, slab, p[i]); i++) {
+			__obj_set_next(cache, tail, p[i]);
+			tail = p[i];
+			count++;
+		}
 
-	pr_debug("kmem_cache '%s': free obj %p (slab %p inuse=%u/%u)\n",
-		 cache->name, obj, sl, sl->inuse, sl->total);
+		__obj_set_next(cache, tail, slab->freelist);
+		slab->freelist = head;
 
-	if (sl->inuse == 0) {
-		// move to free
-		__slab_list_del(sl);
-		__slab_list_add(sl, &cache->free);
-		cache->nr_free_slabs++;
-		__slab_try_reclaim(cache);
+		if (slab->inuse == slab->objects)
+			list_move(&slab->list, &cache->partial);
+
+		slab->inuse -= count;
+
+		if (slab->inuse == 0) {
+			list_move(&slab->list, &cache->free);
+			cache->nr_free_slabs++;
+		}
 	}
+
+	return __slab_shrink(cache, SLAB_MAX_FREE_SLABS);
 }
 
-struct kmem_cache *kmem_cache_create(const char *name, size_t size,
-				     size_t align, void (*ctor)(void *),
-				     void (*dtor)(void *)) {
-	struct kmem_cache *c =
-	    (struct kmem_cache *)kmalloc(sizeof(struct kmem_cache));
-	if (!c)
+/**
+ * __cache_refill - Fill an empty magazine from the slab lists.
+ *
+ * Pulls up to `batchcount` objects with one trip through the cache lock and
+ * returns one of them. Runs with interrupts disabled.
+ */
+static void *__cache_refill(struct kmem_cache *cache, struct array_cache *ac) {
+	spin_lock(&cache->lock);
+	while (ac->avail < ac->batchcount) {
+		unsigned int got = __slab_alloc_bulk(
+		    cache, ac->batchcount - ac->avail, &ac->entry[ac->avail]);
+
+		if (!got)
+			break;
+		ac->avail += got;
+	}
+	spin_unlock(&cache->lock);
+
+	if (!ac->avail)
 		return NULL;
+	return ac->entry[--ac->avail];
+}
+
+/**
+ * __cache_flush - Give the @count oldest objects in a magazine back to their
+ * slabs. Runs with interrupts disabled.
+ */
+static void __cache_flush(struct kmem_cache *cache, struct array_cache *ac,
+			  unsigned int count) {
+	if (count > ac->avail)
+		count = ac->avail;
+
+	spin_lock(&cache->lock);
+	__slab_free_bulk(cache, count, ac->entry);
+	spin_unlock(&cache->lock);
+
+	ac->avail -= count;
+	for (unsigned int i = 0; i < ac->avail; i++)
+		ac->entry[i] = ac->entry[i + count];
+}
+
+static void __cache_init(struct kmem_cache *c, const char *name, size_t size,
+			 size_t align, unsigned long flags,
+			 void (*ctor)(void *), void (*dtor)(void *)) {
+	unsigned int limit;
+	u64 irq_flags;
 
 	if (align == 0)
 		align = sizeof(void *);
+	if ((flags & SLAB_HWCACHE_ALIGN) && align < L1_CACHE_BYTES)
+		align = L1_CACHE_BYTES;
 
 	c->name = name;
-	c->size = __align_up(size, align);
+	c->object_size = size;
 	c->align = align;
+	c->flags = flags;
+
+	if (ctor) {
+		c->offset = __align_up(size, sizeof(void *));
+		c->size = __align_up(c->offset + sizeof(void *), align);
+	} else {
+		c->offset = 0;
+		c->size = __align_up(size, align);
+	}
 	c->ctor = ctor;
 	c->dtor = dtor;
 	INIT_LIST_HEAD(&c->partial);
 	INIT_LIST_HEAD(&c->full);
 	INIT_LIST_HEAD(&c->free);
 	c->nr_free_slabs = 0;
+	c->slabs_created = 0;
+	c->slabs_released = 0;
+	__slab_order(c);
+
+	c->colour_off = align > L1_CACHE_BYTES ? align : L1_CACHE_BYTES;
+	c->colour = c->waste / c->colour_off + 1;
+	c->colour_next = 0;
+
+	spin_init(&c->lock);
+
+	spin_lock_irqsave(&slab_caches_lock, irq_flags);
+	list_add_tail(&c->list, &slab_caches);
+	spin_unlock_irqrestore(&slab_caches_lock, irq_flags);
+
+	limit = c->size >= SLAB_MAG_BIG_OBJECT ? SLAB_MAG_SIZE_BIG
+					       : SLAB_MAG_SIZE;
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+		c->cpu_cache[cpu].avail = 0;
+		c->cpu_cache[cpu].limit = limit;
+		c->cpu_cache[cpu].batchcount = limit / 2;
+		c->cpu_cache[cpu].allocs = 0;
+		c->cpu_cache[cpu].frees = 0;
+	}
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, unsigned long flags,
+				     void (*ctor)(void *),
+				     void (*dtor)(void *)) {
+	struct kmem_cache *c = kmem_cache_alloc(&kmem_cache_cache);
+	if (!c)
+		return NULL;
+
+	__cache_init(c, name, size, align, flags, ctor, dtor);
+
+	pr_debug("kmem_cache '%s': order %u, %u objects per slab, %lu bytes "
+		 "wasted, %u colours\n",
+		 name, c->order, c->objects, (unsigned long)c->waste,
+		 c->colour);
 
 	return c;
 }
 
 void kmem_cache_destroy(struct kmem_cache *cache) {
-	struct slab *sl;
+	struct page *slab;
+	unsigned long flags;
+
+	spin_lock_irqsave(&slab_caches_lock, flags);
+	list_del(&cache->list);
+	spin_unlock_irqrestore(&slab_caches_lock, flags);
+
+	flags = local_irq_save();
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++)
+		__cache_flush(cache, &cache->cpu_cache[cpu],
+			      cache->cpu_cache[cpu].avail);
+	local_irq_restore(flags);
 
 	if (!list_empty(&cache->partial) || !list_empty(&cache->full)) {
 		panic("kmem_cache_destroy: attempting to destroy a cache with "
@@ -242,67 +519,444 @@ void kmem_cache_destroy(struct kmem_cache *cache) {
 	}
 
 	while (!list_empty(&cache->free)) {
-		sl = __slab_list_first(&cache->free);
-		__slab_list_del(sl);
-		__slab_release(sl);
+		slab = __slab_list_first(&cache->free);
+		list_del(&slab->list);
+		__slab_release(slab);
 	}
 
-	kfree(cache);
+	kmem_cache_free(&kmem_cache_cache, cache);
+}
+
+/* Allocate from this CPU's magazine. Runs with interrupts disabled. */
+static inline void *__cache_alloc(struct kmem_cache *cache) {
+	struct array_cache *ac = &cache->cpu_cache[smp_processor_id()];
+	void *obj;
+
+	if (likely(ac->avail))
+		obj = ac->entry[--ac->avail];
+	else
+		obj = __cache_refill(cache, ac);
+	if (likely(obj))
+		ac->allocs++;
+
+	return obj;
 }
 
-void *kmem_cache_alloc(struct kmem_cache *cache) { return __slab_alloc(cache); }
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+	unsigned long flags;
+	void *obj;
+
+	flags = local_irq_save();
+	obj = __cache_alloc(cache);
+	local_irq_restore(flags);
+
+	return obj;
+}
 
 void kmem_cache_free(struct kmem_cache *cache, void *objp) {
+	struct array_cache *ac;
+	unsigned long flags;
+
 	if (!objp)
 		return;
-	__slab_free(cache, objp);
+
+	__slab_check_free(cache, virt_to_slab_page(objp), objp);
+
+	flags = local_irq_save();
+	ac = &cache->cpu_cache[smp_processor_id()];
+	if (unlikely(ac->avail >= ac->limit))
+		__cache_flush(cache, ac, ac->batchcount);
+	ac->entry[ac->avail++] = objp;
+	ac->frees++;
+	local_irq_restore(flags);
+}
+
+int kmem_cache_alloc_bulk(struct kmem_cache *cache, size_t nr, void **p) {
+	struct array_cache *ac;
+	unsigned long flags;
+	size_t i = 0;
+
+	flags = local_irq_save();
+	ac = &cache->cpu_cache[smp_processor_id()];
+	while (i < nr && ac->avail)
+		p[i++] = ac->entry[--ac->avail];
+
+	if (i < nr) {
+		spin_lock(&cache->lock);
+		while (i < nr) {
+			unsigned int got;
+
+			got = __slab_alloc_bulk(cache, nr - i, &p[i]);
+			if (!got)
+				break;
+			i += got;
+		}
+		spin_unlock(&cache->lock);
+	}
+	ac->allocs += i;
+	local_irq_restore(flags);
+
+	if (unlikely(i < nr)) {
+		kmem_cache_free_bulk(cache, i, p);
+		return 0;
+	}
+
+	return (int)nr;
+}
+
+void kmem_cache_free_bulk(struct kmem_cache *cache, size_t nr, void **p) {
+	struct array_cache *ac;
+	unsigned long flags;
+
+	for (size_t i = 0; i < nr; i++)
+		__slab_check_free(cache, virt_to_slab_page(p[i]), p[i]);
+
+	flags = local_irq_save();
+	ac = &cache->cpu_cache[smp_processor_id()];
+	ac->frees += nr;
+	while (nr && ac->avail < ac->limit)
+		ac->entry[ac->avail++] = p[--nr];
+
+	if (nr) {
+		spin_lock(&cache->lock);
+		__slab_free_bulk(cache, nr, p);
+		spin_unlock(&cache->lock);
+	}
+	local_irq_restore(flags);
 }
 
 static void __kmalloc_caches_init(void) {
 	if (kmalloc_caches_inited)
 		return;
 
+	__cache_init(&kmem_cache_cache, "kmem_cache", sizeof(struct kmem_cache),
+		     0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+
 	for (unsigned int i = 0; i < KMALLOC_NUM_CACHES; i++) {
-		struct kmem_cache *c = &kmalloc_caches[i];
-		size_t sz = (size_t)1 << (KMALLOC_MIN_SHIFT + i);
-		c->name = "kmalloc";
-		c->size = __align_up(sz, sizeof(void *));
-		c->align = sizeof(void *);
-		c->ctor = NULL;
-		c->dtor = NULL;
-		INIT_LIST_HEAD(&c->partial);
-		INIT_LIST_HEAD(&c->full);
-		INIT_LIST_HEAD(&c->free);
-		c->nr_free_slabs = 0;
+		unsigned int lo = i ? kmalloc_sizes[i - 1] : 0;
+
+		__cache_init(&kmalloc_caches[i], kmalloc_names[i],
+			     kmalloc_sizes[i], sizeof(void *), 0, NULL, NULL);
+
+		kmalloc_hist_shift[i] = __builtin_ctz(kmalloc_sizes[i] - lo);
+	}
+
+	for (unsigned int i = 0, idx = 0; i < KMALLOC_TABLE_MAX / 8; i++) {
+		while (kmalloc_sizes[idx] < (i + 1) * 8)
+			idx++;
+		size_index[i] = idx;
 	}
 
 	kmalloc_caches_inited = 1;
 }
 
-static inline int __size_to_index(size_t size) {
-	int idx = 0;
-	size_t s = (size_t)1 << KMALLOC_MIN_SHIFT;
-	while (s < size && (KMALLOC_MIN_SHIFT + idx) < KMALLOC_MAX_SHIFT) {
-		s <<= 1;
-		idx++;
+static inline unsigned int __size_to_index(size_t size) {
+	if (size <= KMALLOC_TABLE_MAX)
+		return size_index[(size - 1) >> 3];
+	return 64 - __builtin_clzl(size - 1);
+}
+
+unsigned int kmalloc_size_index(size_t size) {
+	if (unlikely(size == 0 || size > KMALLOC_MAX_CACHE_SIZE))
+		panic("kmalloc_size_index: no class for %lu bytes",
+		      (unsigned long)size);
+	return __size_to_index(size);
+}
+
+void *kmalloc_class_alloc(unsigned int idx, size_t size) {
+	size_t lo = idx ? kmalloc_sizes[idx - 1] : 0;
+	struct kmalloc_class_stats *st;
+	unsigned long flags;
+	void *obj;
+
+	flags = local_irq_save();
+	st = &kmalloc_cpu_hists[smp_processor_id()].class[idx];
+	st->requests++;
+	st->bytes += size;
+	st->hist[((size - lo - 1) * KMALLOC_HIST_BUCKETS) >>
+		 kmalloc_hist_shift[idx]]++;
+	obj = __cache_alloc(&kmalloc_caches[idx]);
+	local_irq_restore(flags);
+
+	return obj;
+}
+
+int kmalloc_get_class_stats(unsigned int idx,
+			    struct kmalloc_class_stats *stats) {
+	if (idx >= KMALLOC_NUM_CACHES || !stats)
+		return -1;
+
+	/* The per-CPU counters are read racily; a snapshot is all we need. */
+	memset(stats, 0, sizeof(*stats));
+	stats->size = kmalloc_sizes[idx];
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+		const struct kmalloc_class_stats *st =
+		    &kmalloc_cpu_hists[cpu].class[idx];
+
+		stats->requests += st->requests;
+		stats->bytes += st->bytes;
+		for (unsigned int b = 0; b < KMALLOC_HIST_BUCKETS; b++)
+			stats->hist[b] += st->hist[b];
+	}
+
+	return 0;
+}
+
+void kmalloc_dump_stats(void) {
+	for (unsigned int i = 0; i < KMALLOC_NUM_CACHES; i++) {
+		struct kmalloc_class_stats st;
+
+		kmalloc_get_class_stats(i, &st);
+		if (!st.requests)
+			continue;
+
+		pr_info("%s: %lu requests, %lu bytes avg, [%lu %lu %lu %lu]\n",
+			kmalloc_names[i], st.requests, st.bytes / st.requests,
+			st.hist[0], st.hist[1], st.hist[2], st.hist[3]);
+	}
+}
+
+/**
+ * Free slabs are counted as reclaimable. Scanning also empties this CPU's
+ * magazines, which can turn partial slabs into free ones. Caches whose lock
+ * is taken are skipped: the allocation that needs the memory may well be
+ * coming from one of them.
+ */
+static unsigned long slab_shrink_count(struct shrinker *s) {
+	struct list_head *pos;
+	unsigned long count = 0;
+	u64 flags;
+
+	(void)s;
+
+	spin_lock_irqsave(&slab_caches_lock, flags);
+	list_for_each(pos, &slab_caches) {
+		struct kmem_cache *cache =
+		    list_entry(pos, struct kmem_cache, list);
+
+		count += (unsigned long)cache->nr_free_slabs << cache->order;
+	}
+	spin_unlock_irqrestore(&slab_caches_lock, flags);
+
+	return count;
+}
+
+static unsigned long slab_shrink_scan(struct shrinker *s, unsigned long nr) {
+	struct list_head *pos;
+	unsigned long freed = 0;
+	u64 flags;
+
+	(void)s;
+
+	flags = local_irq_save();
+	if (!spin_trylock(&slab_caches_lock)) {
+		local_irq_restore(flags);
+		return 0;
+	}
+
+	list_for_each(pos, &slab_caches) {
+		struct kmem_cache *cache =
+		    list_entry(pos, struct kmem_cache, list);
+		struct array_cache *ac;
+
+		if (freed >= nr)
+			break;
+		if (!spin_trylock(&cache->lock))
+			continue;
+
+		ac = &cache->cpu_cache[smp_processor_id()];
+		freed += __slab_free_bulk(cache, ac->avail, ac->entry);
+		ac->avail = 0;
+		freed += __slab_shrink(cache, 0);
+
+		spin_unlock(&cache->lock);
 	}
-	return idx;
+
+	spin_unlock_irqrestore(&slab_caches_lock, flags);
+
+	return freed;
 }
 
+static struct shrinker slab_shrinker = {
+    .count_pages = slab_shrink_count,
+    .scan_pages = slab_shrink_scan,
+};
+
 int slab_init_kmalloc_caches(void) {
 	__kmalloc_caches_init();
+	register_shrinker(&slab_shrinker);
 	pr_info("initialized kmalloc caches (%u classes)\n",
 		KMALLOC_NUM_CACHES);
+
+	for (unsigned int i = 0; i < KMALLOC_NUM_CACHES; i++) {
+		struct kmem_cache *c = &kmalloc_caches[i];
+
+		pr_debug("kmalloc-%lu: order %u, %u objects per slab, %lu "
+			 "bytes wasted\n",
+			 (unsigned long)c->size, c->order, c->objects,
+			 (unsigned long)c->waste);
+	}
 	return 0;
 }
 
 struct kmem_cache *slab_get_kmalloc_cache(size_t size) {
-	if (unlikely(size > (1UL << KMALLOC_MAX_SHIFT))) {
+	if (unlikely(size == 0 || size > KMALLOC_MAX_CACHE_SIZE)) {
 		return NULL;
 	}
-	int idx = __size_to_index(size);
-	if (idx >= (int)KMALLOC_NUM_CACHES) {
-		return NULL;
+	return &kmalloc_caches[__size_to_index(size)];
+}
+
+void kmem_cache_get_stats(struct kmem_cache *cache,
+			  struct kmem_cache_stats *stats) {
+	struct list_head *pos;
+	unsigned long inuse = 0, cached = 0, nr_slabs;
+	u64 flags;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+		stats->allocs += cache->cpu_cache[cpu].allocs;
+		stats->frees += cache->cpu_cache[cpu].frees;
+		cached += cache->cpu_cache[cpu].avail;
+	}
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_for_each(pos, &cache->full)
+		stats->nr_full++;
+	list_for_each(pos, &cache->partial) {
+		inuse += list_entry(pos, struct page, list)->inuse;
+		stats->nr_partial++;
 	}
-	return &kmalloc_caches[idx];
+	stats->nr_free = cache->nr_free_slabs;
+	stats->slabs_created = cache->slabs_created;
+	stats->slabs_released = cache->slabs_released;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	/* Objects sitting in a magazine are in use as far as their slab knows. */
+	inuse += stats->nr_full * cache->objects;
+	stats->active_objs = inuse > cached ? inuse - cached : 0;
+
+	nr_slabs = stats->nr_full + stats->nr_partial + stats->nr_free;
+	stats->total_objs = nr_slabs * cache->objects;
+	stats->bytes_wasted =
+	    nr_slabs * cache->waste +
+	    stats->total_objs * (cache->size - cache->object_size);
+}
+
+void slabinfo_show(void) {
+	struct list_head *pos;
+	u64 flags;
+
+	printk("# active    total  objsize objs/slab pages/slab   full  "
+	       "partial   free     allocs      frees  created released  "
+	       "wasted name\n");
+
+	spin_lock_irqsave(&slab_caches_lock, flags);
+	list_for_each(pos, &slab_caches) {
+		struct kmem_cache *c = list_entry(pos, struct kmem_cache, list);
+		struct kmem_cache_stats st;
+
+		kmem_cache_get_stats(c, &st);
+		printk("%8lu %8lu %8lu %9u %10lu %6lu %8lu %6lu %10lu %10lu "
+		       "%8lu %8lu %7lu %s\n",
+		       st.active_objs, st.total_objs,
+		       (unsigned long)c->object_size, c->objects,
+		       1UL << c->order, st.nr_full, st.nr_partial, st.nr_free,
+		       st.allocs, st.frees, st.slabs_created,
+		       st.slabs_released, st.bytes_wasted, c->name);
+	}
+	spin_unlock_irqrestore(&slab_caches_lock, flags);
+}
+
+static void slabinfo_read(struct device *dev, const char *buf) {
+	(void)dev;
+	(void)buf;
+	slabinfo_show();
+}
+
+static int __init slabinfo_init(void) {
+	if (!devicefs_add("slabinfo", NULL, slabinfo_read, NULL))
+		pr_warn("failed to register the slabinfo device\n");
+	return 0;
+}
+
+fs_initcall(slabinfo_init);
+
+#ifdef SERENOS_TEST_BUILD
+/**
+ * Compares construct-once caching against running the constructor on every
+ * allocation, the way kmem_cache_alloc() used to. The object stands in for
+ * something like a task struct: a lock, a list head and a buffer that all
+ * need setting up before use.
+ */
+#define SLAB_BENCH_OBJECTS 64
+#define SLAB_BENCH_ROUNDS  256
+
+struct slab_bench_obj {
+	spinlock_t lock;
+	struct list_head node;
+	u8 buf[480];
+};
+
+static void __slab_bench_ctor(void *p) {
+	struct slab_bench_obj *o = p;
+
+	spin_init(&o->lock);
+	INIT_LIST_HEAD(&o->node);
+	memset(o->buf, 0, sizeof(o->buf));
+}
+
+static u64 __slab_bench_run(struct kmem_cache *cache, int ctor_on_alloc) {
+	void *objs[SLAB_BENCH_OBJECTS];
+	u64 start = rdtsc();
+
+	for (unsigned int r = 0; r < SLAB_BENCH_ROUNDS; r++) {
+		for (unsigned int i = 0; i < SLAB_BENCH_OBJECTS; i++) {
+			objs[i] = kmem_cache_alloc(cache);
+			if (ctor_on_alloc)
+				__slab_bench_ctor(objs[i]);
+		}
+		for (unsigned int i = 0; i < SLAB_BENCH_OBJECTS; i++)
+			kmem_cache_free(cache, objs[i]);
+	}
+
+	return (rdtsc() - start) / (SLAB_BENCH_ROUNDS * SLAB_BENCH_OBJECTS);
+}
+
+static int __init slab_bench(void) {
+	struct kmem_cache *once, *every;
+	u64 once_cycles, every_cycles;
+
+	once = kmem_cache_create("bench-ctor-once",
+				 sizeof(struct slab_bench_obj), 0, 0,
+				 __slab_bench_ctor, NULL);
+	every = kmem_cache_create("bench-ctor-every",
+				  sizeof(struct slab_bench_obj), 0, 0, NULL,
+				  NULL);
+	if (!once || !every) {
+		pr_err("bench: failed to create caches\n");
+		if (once)
+			kmem_cache_destroy(once);
+		if (every)
+			kmem_cache_destroy(every);
+		return -1;
+	}
+
+	/* Warm both caches up so neither pays for new slabs in the loop. */
+	__slab_bench_run(once, 0);
+	__slab_bench_run(every, 1);
+
+	once_cycles = __slab_bench_run(once, 0);
+	every_cycles = __slab_bench_run(every, 1);
+
+	pr_info("bench: alloc+free of %lu-byte objects: %lu cycles with "
+		"construct-once, %lu cycles with ctor on every alloc\n",
+		(unsigned long)sizeof(struct slab_bench_obj),
+		(unsigned long)once_cycles, (unsigned long)every_cycles);
+
+	kmem_cache_destroy(once);
+	kmem_cache_destroy(every);
+	return 0;
 }
+device_initcall(slab_bench);
+#endif